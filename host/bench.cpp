@@ -0,0 +1,303 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host microbenchmarks for the Calendar/TimeSignal core, so that changes to
+ * the per-minute frame build can be measured without flashing a board.
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+#include "clockson/calendar.h"
+#include "clockson/clock_mapping.h"
+#include "clockson/envelope.h"
+#include "clockson/msf_decoder.h"
+#include "clockson/schedule.h"
+#include "clockson/standard.h"
+#include "clockson/time_signal.h"
+
+using namespace clockson;
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+namespace {
+
+/* 2000-01-01 00:00:00 UTC */
+static constexpr time_t Y2000_S = 946684800;
+/* 2024-01-01 00:00:00 UTC */
+static constexpr time_t Y2024_S = 1704067200;
+/* 2025-01-01 00:00:00 UTC */
+static constexpr time_t Y2025_S = 1735689600;
+/* 2024-01-02 00:00:00 UTC */
+static constexpr time_t Y2024_DAY2_S = Y2024_S + 86400;
+/* 2100-01-01 00:00:00 UTC */
+static constexpr time_t Y2100_S = 4102444800;
+
+/* Accumulate results so that the compiler can't discard the work */
+static volatile uint64_t sink;
+
+static const char *filter{nullptr};
+
+static void run(const char *name, uint64_t count,
+		const std::function<uint64_t()> &func) {
+	if (filter && !std::strstr(name, filter)) {
+		return;
+	}
+
+	auto start = steady_clock::now();
+	uint64_t result = func();
+	auto elapsed = duration<double, std::nano>(steady_clock::now() - start);
+
+	sink = sink + result;
+
+	std::printf("%-40s %12" PRIu64 " %10.3f ms %10.2f ns/op\n",
+		name, count, elapsed.count() / 1e6, elapsed.count() / count);
+}
+
+static uint64_t checksum(const Calendar &calendar) {
+	return calendar.year() ^ calendar.month() ^ calendar.day()
+		^ calendar.weekday() ^ calendar.hour() ^ calendar.minute()
+		^ calendar.summer() ^ calendar.summer_change_soon();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	if (argc > 2) {
+		std::fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+		return EXIT_FAILURE;
+	} else if (argc == 2) {
+		filter = argv[1];
+	}
+
+	std::printf("%-40s %12s %13s %16s\n", "benchmark", "iterations", "total", "per iteration");
+
+	run("gmtime_r 2000-2100/h", (Y2100_S - Y2000_S) / 3600, [] {
+		uint64_t result = 0;
+
+		for (time_t t = Y2000_S; t < Y2100_S; t += 3600) {
+			struct tm tm{};
+
+			gmtime_r(&t, &tm);
+			result += tm.tm_year ^ tm.tm_mon ^ tm.tm_mday ^ tm.tm_wday
+				^ tm.tm_hour ^ tm.tm_min;
+		}
+
+		return result;
+	});
+
+	run("Calendar(time_t) 2000-2100/h", (Y2100_S - Y2000_S) / 3600, [] {
+		uint64_t result = 0;
+
+		for (time_t t = Y2000_S; t < Y2100_S; t += 3600) {
+			result += checksum(Calendar{t});
+		}
+
+		return result;
+	});
+
+	run("Calendar(time_t) 2024/min", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			result += checksum(Calendar{t});
+		}
+
+		return result;
+	});
+
+	run("TimeSignal(time_t, ClockMapping) 2024", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			TimeSignal signal{t, ClockMapping{1000000}};
+
+			while (signal.available()) {
+				result += signal.next().ts;
+				signal.pop();
+			}
+		}
+
+		return result;
+	});
+
+	run("TimeSignal::next_minute 2024", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+		TimeSignal signal{Y2024_S - 60, ClockMapping{1000000}};
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			signal = signal.next_minute(ClockMapping{1000000});
+
+			while (signal.available()) {
+				result += signal.next().ts;
+				signal.pop();
+			}
+		}
+
+		return result;
+	});
+
+	run("TimeSignal::next_minute 2024 (build)", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+		TimeSignal signal{Y2024_S - 60, ClockMapping{1000000}};
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			signal = signal.next_minute(ClockMapping{1000000});
+			result += signal.next().ts;
+		}
+
+		return result;
+	});
+
+	run("Schedule (4 standards) 2024", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+		Schedule<standard::MSF, standard::DCF77, standard::WWVB, standard::JJY>
+			schedule{{true, true, true, true}};
+
+		schedule.start(Y2024_S - 60, ClockMapping{1000000});
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			schedule.next_minute(ClockMapping{1000000});
+
+			while (schedule.available()) {
+				result += schedule.next().ts + schedule.output();
+				schedule.pop();
+			}
+		}
+
+		return result;
+	});
+
+	run("Envelope::encode 2024", (Y2025_S - Y2024_S) / 60, [] {
+		static Envelope envelope;
+		uint64_t result = 0;
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			TimeSignal signal{t, ClockMapping{1000000}};
+
+			envelope.encode(signal, signal.next().unsigned_ts() - 500000, 0, 1);
+			result += envelope.size();
+		}
+
+		return result;
+	});
+
+	static constexpr unsigned int BCD_COUNT = 10000000;
+
+	run("set_bcd", BCD_COUNT, [] {
+		standard::data_t data;
+
+		for (unsigned int i = 0; i < BCD_COUNT; i++) {
+			standard::set_bcd(data, 17, 24, i % 100U);
+		}
+
+		return data.to_ullong();
+	});
+
+	run("odd_parity", BCD_COUNT, [] {
+		uint64_t result = 0;
+		standard::data_t data;
+
+		for (unsigned int i = 0; i < BCD_COUNT; i++) {
+			data = standard::data_t{i * 0x9E3779B97F4A7C15ULL};
+			result += standard::odd_parity(data, 39, 51);
+		}
+
+		return result;
+	});
+
+	run("Calendar::to_string 2024", (Y2025_S - Y2024_S) / 60, [] {
+		uint64_t result = 0;
+
+		for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+			result += std::strlen(Calendar{t}.to_string().data());
+		}
+
+		return result;
+	});
+
+	/*
+	 * Decode a day of time signals repeatedly, shifting the edges forward by
+	 * a day each time so that they keep increasing
+	 */
+	static constexpr unsigned int DECODE_DAYS = 366;
+
+	run("MsfDecoder::edge 2024-01-01 x366", (Y2024_DAY2_S - Y2024_S) / 60 * DECODE_DAYS, [] {
+		std::vector<Signal> edges;
+		TimeSignal signal = TimeSignal::at_minute(Y2024_S, ClockMapping{0});
+
+		for (time_t t = Y2024_S; t < Y2024_DAY2_S; t += 60) {
+			while (signal.available()) {
+				edges.push_back(signal.next());
+				signal.pop();
+			}
+
+			signal = signal.next_minute(ClockMapping{0});
+		}
+
+		MsfDecoder decoder;
+		uint64_t result = 0;
+
+		for (unsigned int day = 0; day < DECODE_DAYS; day++) {
+			const int64_t offset_us = day * 86400000000LL;
+
+			for (const auto &edge : edges) {
+				if (decoder.edge(edge.ts + offset_us, edge.carrier)) {
+					result += decoder.minute().errors + decoder.minute().utc_time;
+				}
+			}
+		}
+
+		return result;
+	});
+
+	run("MsfDecoder::decode 2024-01-01 x366", (Y2024_DAY2_S - Y2024_S) / 60 * DECODE_DAYS, [] {
+		std::vector<standard::MSF::Frame> frames;
+
+		for (time_t t = Y2024_S; t < Y2024_DAY2_S; t += 60) {
+			standard::MSF::Frame frame{};
+
+			standard::MSF::encode(frame, Calendar{t}, nullptr);
+			frames.push_back(frame);
+		}
+
+		uint64_t result = 0;
+
+		for (unsigned int day = 0; day < DECODE_DAYS; day++) {
+			for (const auto &frame : frames) {
+				uint64_t utc_time;
+
+				result += MsfDecoder::decode(frame, 2000, utc_time) + utc_time;
+			}
+		}
+
+		return result;
+	});
+
+	return EXIT_SUCCESS;
+}
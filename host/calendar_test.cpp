@@ -0,0 +1,232 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for Calendar, comparing the local time and summer time flags
+ * for each zone with the time from the C library. The summer time rules are
+ * evaluated separately using timegm() and gmtime_r(). Every calendar is
+ * also advanced with next() to check that it matches the calendar for the
+ * following minute.
+ *
+ * By default every day from 1970 to 3000 is checked at varying times of day,
+ * with every minute around each summer time change and each of the test time
+ * dates. Run with "all" to check every minute from 1970 to 3000 (which takes
+ * several minutes).
+ */
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "clockson/calendar.h"
+
+using namespace clockson;
+
+namespace {
+
+/* 1970-01-01 00:00:00 UTC */
+static constexpr time_t Y1970_S = 0;
+/* 3001-01-01 00:00:00 UTC */
+static constexpr time_t Y3001_S = 32535216000;
+static constexpr int FIRST_YEAR = 1970;
+static constexpr int LAST_YEAR = 3000;
+
+/*
+ * Summer time changes are announced 61 minutes in advance for MSF (UK) and
+ * one hour in advance for DCF77 (CET)
+ */
+static constexpr time_t UK_SUMMER_WARNING_S = 61 * 60;
+static constexpr time_t CET_SUMMER_WARNING_S = 60 * 60;
+
+/* Interval for checking each day at a different time of day */
+static constexpr time_t DAILY_INTERVAL_S = 6 * 3600 + 7 * 60;
+
+/* Minutes to check around each summer time change and test time */
+static constexpr time_t AROUND_CHANGE_S = 2 * 3600;
+static constexpr time_t AROUND_TEST_TIME_S = 86400;
+
+/* Test times from the configuration */
+static constexpr time_t TEST_TIMES_S[] = {
+	946684430, /* 1999-12-31 23:53:50 */
+	946684800, /* 2000-01-01 00:00:00 */
+	2147483270, /* 2038-01-19 03:07:50 */
+	3551598000, /* 2082-07-18 12:00:00 */
+	4102444430, /* 2099-12-31 23:53:50 */
+	4294966910, /* 2106-02-07 06:21:50 */
+	32503680000, /* 3000-01-01 00:00:00 */
+};
+
+/* Maximum number of differences to print */
+static constexpr unsigned int MAX_REPORTS = 20;
+
+struct SummerTime {
+	time_t begin_s;
+	time_t end_s;
+};
+
+/* European summer time rules for each year */
+static std::vector<SummerTime> summer_times;
+
+static uint64_t checked;
+static uint64_t failures;
+
+/* 01:00 UTC on the last Sunday of a month that has 31 days */
+static time_t last_sunday(int year, int month) {
+	struct tm tm{};
+
+	tm.tm_year = year - 1900;
+	tm.tm_mon = month - 1;
+	tm.tm_mday = 31;
+	tm.tm_hour = 1;
+
+	time_t t = timegm(&tm);
+
+	gmtime_r(&t, &tm);
+	return t - tm.tm_wday * 86400;
+}
+
+static bool summer(time_t t) {
+	struct tm tm{};
+
+	gmtime_r(&t, &tm);
+
+	int year = tm.tm_year + 1900;
+
+	if (year < FIRST_YEAR || year > LAST_YEAR + 1) {
+		return false;
+	}
+
+	const SummerTime &summer_time = summer_times[year - FIRST_YEAR];
+
+	return t >= summer_time.begin_s && t < summer_time.end_s;
+}
+
+template <class Zone>
+static bool same(const BasicCalendar<Zone> &a, const BasicCalendar<Zone> &b) {
+	return a.utc_time() == b.utc_time() && a.year() == b.year()
+		&& a.month() == b.month() && a.day() == b.day()
+		&& a.weekday() == b.weekday() && a.hour() == b.hour()
+		&& a.minute() == b.minute() && a.summer() == b.summer()
+		&& a.summer_change_soon() == b.summer_change_soon();
+}
+
+template <class Zone>
+static void check_next(const char *name, const BasicCalendar<Zone> &calendar) {
+	BasicCalendar<Zone> next = calendar.next();
+	BasicCalendar<Zone> expected{(time_t)calendar.utc_time() + 60};
+
+	if (!same(next, expected) && ++failures <= MAX_REPORTS) {
+		std::printf("%s %" PRIu64 ": next() %s, expected %s\n", name,
+			calendar.utc_time(), next.to_string().data(),
+			expected.to_string().data());
+	}
+}
+
+template <class Zone>
+static void check(const char *name, time_t warning_s, time_t t) {
+	BasicCalendar<Zone> calendar{t};
+	time_t minute = t / 60 * 60;
+	bool expected_summer = Zone::SUMMER_TIME && summer(minute);
+	bool expected_soon = Zone::SUMMER_TIME
+		&& summer(minute + warning_s) != expected_summer;
+	time_t local = minute + Zone::OFFSET_S + (expected_summer ? 3600 : 0);
+	struct tm tm{};
+
+	gmtime_r(&local, &tm);
+	checked++;
+	check_next(name, calendar);
+
+	if (calendar.utc_time() == (uint64_t)minute
+			&& calendar.year() == tm.tm_year + 1900
+			&& calendar.month() == tm.tm_mon + 1
+			&& calendar.day() == tm.tm_mday
+			&& calendar.day_of_year() == tm.tm_yday + 1
+			&& calendar.weekday() == tm.tm_wday
+			&& calendar.hour() == tm.tm_hour
+			&& calendar.minute() == tm.tm_min
+			&& calendar.summer() == expected_summer
+			&& calendar.summer_change_soon() == expected_soon) {
+		return;
+	}
+
+	if (++failures <= MAX_REPORTS) {
+		std::printf("%s %" PRId64 ": %s, expected %04d-%02d-%02dT%02d:%02d"
+			" (day %d, weekday %d, summer %d, soon %d)\n", name, (int64_t)t,
+			calendar.to_string().data(), tm.tm_year + 1900, tm.tm_mon + 1,
+			tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_yday + 1, tm.tm_wday,
+			expected_summer, expected_soon);
+	}
+}
+
+static void check_all_zones(time_t t) {
+	check<zone::UK>("UK", UK_SUMMER_WARNING_S, t);
+	check<zone::CET>("CET", CET_SUMMER_WARNING_S, t);
+	check<zone::UTC>("UTC", 0, t);
+	check<zone::JST>("JST", 0, t);
+}
+
+static void check_range(time_t begin_s, time_t end_s, time_t interval_s) {
+	for (time_t t = begin_s; t < end_s; t += interval_s) {
+		check_all_zones(t);
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	bool all = false;
+
+	if (argc > 2 || (argc == 2 && std::strcmp(argv[1], "all"))) {
+		std::fprintf(stderr, "Usage: %s [all]\n", argv[0]);
+		return EXIT_FAILURE;
+	} else if (argc == 2) {
+		all = true;
+	}
+
+	for (int year = FIRST_YEAR; year <= LAST_YEAR + 1; year++) {
+		summer_times.push_back({last_sunday(year, 3), last_sunday(year, 10)});
+	}
+
+	if (all) {
+		check_range(Y1970_S, Y3001_S, 60);
+	} else {
+		check_range(Y1970_S, Y3001_S, DAILY_INTERVAL_S);
+
+		for (const auto &summer_time : summer_times) {
+			for (time_t change_s : {summer_time.begin_s, summer_time.end_s}) {
+				check_range(change_s - AROUND_CHANGE_S,
+					change_s + AROUND_CHANGE_S, 60);
+			}
+		}
+
+		for (time_t test_s : TEST_TIMES_S) {
+			check_range(test_s - AROUND_TEST_TIME_S,
+				test_s + AROUND_TEST_TIME_S, 60);
+		}
+	}
+
+	std::printf("%" PRIu64 " times checked, %" PRIu64 " differences\n",
+		checked, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
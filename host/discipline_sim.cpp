@@ -0,0 +1,301 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulation of the system clock discipline, comparing the previous
+ * behaviour (one clamped step of the measured offset per transmission) with
+ * the ClockDiscipline estimator, using a crystal with a frequency error that
+ * varies with temperature and SNTP samples with synthetic network noise.
+ *
+ * Holdover is simulated by stopping the SNTP samples, to check that the
+ * estimated error bound is never exceeded and how long it stays within the
+ * limit.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numbers>
+#include <random>
+#include <vector>
+
+#include "clockson/discipline.h"
+
+using namespace clockson;
+
+namespace {
+
+/* Same limits as Network */
+static constexpr int64_t UPPER_TIME_STEP_US = 750000;
+static constexpr int64_t UPPER_TIME_SLEW_US = 25000;
+
+static constexpr uint64_t SIMULATION_S = 48 * 3600;
+/* Statistics for the steady state are from the second half */
+static constexpr uint64_t STEADY_STATE_S = SIMULATION_S / 2;
+static constexpr uint64_t SNTP_INTERVAL_S = 60;
+static constexpr uint64_t SNTP_PHASE_S = 17;
+static constexpr uint64_t TRANSMIT_INTERVAL_S = 60;
+/* Same as the default configuration of Network::TIME_ERROR_LIMIT_US */
+static constexpr double HOLDOVER_LIMIT_US = 500000.0;
+/* Holdover starts at different phases of the temperature changes */
+static constexpr uint64_t HOLDOVER_START_S = SIMULATION_S / 2;
+static constexpr uint64_t HOLDOVER_STARTS = 8;
+static constexpr uint64_t HOLDOVER_START_INTERVAL_S = 45 * 60;
+/* Previous fixed time that the clock was assumed to be valid for */
+static constexpr uint64_t PREVIOUS_VALID_S = 3 * 3600;
+
+struct Scenario {
+	const char *name;
+	/* Crystal frequency error, varying sinusoidally with temperature */
+	double frequency_ppm;
+	double temperature_ppm;
+	double temperature_period_s;
+	/* Network delay noise */
+	double noise_us;
+	double outlier_rate;
+	double outlier_max_us;
+	/* Initial error of the system clock */
+	double initial_us;
+	/* Maximum error when converged */
+	double converged_us;
+};
+
+struct Result {
+	double rms_us;
+	double p99_us;
+	double max_us;
+	/* Time after the first sync until the error stays within converged_us */
+	double converged_s;
+	unsigned int adjustments;
+};
+
+struct HoldoverResult {
+	/* Shortest time until the error bound exceeds the limit */
+	double valid_s;
+	/* Maximum error while the error bound is within the limit */
+	double max_us;
+	/* Maximum ratio of the error to the error bound */
+	double max_ratio;
+	/* Maximum error after the previous fixed time */
+	double previous_us;
+};
+
+enum class Mode {
+	PREVIOUS,
+	DISCIPLINE,
+};
+
+/*
+ * Simulate the system clock, with holdover (no more SNTP samples) from
+ * holdover_s if it's not 0
+ */
+static Result simulate(const Scenario &scenario, Mode mode,
+		uint64_t holdover_s = 0, HoldoverResult *holdover = nullptr) {
+	std::mt19937_64 rng{1};
+	std::normal_distribution<double> noise{0.0, scenario.noise_us};
+	std::uniform_real_distribution<double> uniform{0.0, 1.0};
+	ClockDiscipline discipline;
+	std::vector<double> errors;
+	double uptime_us = 0;
+	/* Corrections applied to the system clock */
+	double correction_us = scenario.initial_us;
+	bool synced = false;
+	bool slew_allowed = false;
+	double last_unconverged_s = 0;
+	double first_sync_s = 0;
+	Result result{};
+
+	for (uint64_t t = 1; t <= SIMULATION_S; t++) {
+		const double frequency = (scenario.frequency_ppm + scenario.temperature_ppm
+			* std::sin(2.0 * std::numbers::pi * t / scenario.temperature_period_s)) / 1e6;
+
+		uptime_us += 1e6 * (1.0 + frequency);
+
+		/* Reference time minus system time */
+		const double error_us = t * 1e6 - (uptime_us + correction_us);
+
+		if (t % SNTP_INTERVAL_S == SNTP_PHASE_S && (!holdover_s || t < holdover_s)) {
+			double offset_us = error_us + noise(rng);
+
+			if (uniform(rng) < scenario.outlier_rate) {
+				offset_us += uniform(rng) * scenario.outlier_max_us;
+			}
+
+			const int64_t delta_us = std::llround(offset_us);
+
+			if (!synced || std::abs(delta_us) >= UPPER_TIME_STEP_US) {
+				/* Stepped by SNTP */
+				correction_us += delta_us;
+				discipline.step(uptime_us);
+				synced = true;
+				first_sync_s = t;
+				last_unconverged_s = t;
+			} else if (mode == Mode::PREVIOUS) {
+				if (slew_allowed) {
+					correction_us += std::clamp(delta_us, -UPPER_TIME_SLEW_US, UPPER_TIME_SLEW_US);
+					slew_allowed = false;
+					result.adjustments++;
+				}
+			} else {
+				discipline.sample(uptime_us, delta_us);
+			}
+		}
+
+		if (t % TRANSMIT_INTERVAL_S == 0) {
+			if (mode == Mode::PREVIOUS) {
+				slew_allowed = true;
+			} else if (synced) {
+				int64_t adjust_us = discipline.adjustment(uptime_us, UPPER_TIME_SLEW_US);
+
+				if (adjust_us) {
+					correction_us += adjust_us;
+					result.adjustments++;
+				}
+			}
+		}
+
+		/*
+		 * The offset between uptime and the system clock is read when each
+		 * transmission is prepared
+		 */
+		if (!synced || t % TRANSMIT_INTERVAL_S != 0) {
+			continue;
+		}
+
+		const double current_us = t * 1e6 - (uptime_us + correction_us);
+
+		if (std::abs(current_us) > scenario.converged_us) {
+			last_unconverged_s = t;
+		}
+
+		if (t >= STEADY_STATE_S) {
+			errors.push_back(std::abs(current_us));
+		}
+
+		if (holdover_s && t >= holdover_s) {
+			const double bound_us = discipline.error_bound_us(uptime_us);
+
+			if (bound_us <= HOLDOVER_LIMIT_US) {
+				holdover->valid_s = t - holdover_s;
+				holdover->max_us = std::max(holdover->max_us, std::abs(current_us));
+			}
+
+			holdover->max_ratio = std::max(holdover->max_ratio,
+				std::abs(current_us) / bound_us);
+
+			if (t - holdover_s == PREVIOUS_VALID_S) {
+				holdover->previous_us = std::abs(current_us);
+			}
+		}
+	}
+
+	double sum = 0;
+
+	for (double error_us : errors) {
+		sum += error_us * error_us;
+	}
+
+	std::sort(errors.begin(), errors.end());
+
+	result.rms_us = std::sqrt(sum / errors.size());
+	result.p99_us = errors[errors.size() * 99 / 100];
+	result.max_us = errors.back();
+	result.converged_s = last_unconverged_s >= STEADY_STATE_S
+		? NAN : last_unconverged_s - first_sync_s;
+	return result;
+}
+
+/* Holdover from each of the start times, combining the worst results */
+static HoldoverResult simulate_holdover(const Scenario &scenario) {
+	HoldoverResult worst{INFINITY, 0, 0, 0};
+
+	for (uint64_t i = 0; i < HOLDOVER_STARTS; i++) {
+		HoldoverResult result{};
+
+		simulate(scenario, Mode::DISCIPLINE,
+			HOLDOVER_START_S + i * HOLDOVER_START_INTERVAL_S, &result);
+
+		worst.valid_s = std::min(worst.valid_s, result.valid_s);
+		worst.max_us = std::max(worst.max_us, result.max_us);
+		worst.max_ratio = std::max(worst.max_ratio, result.max_ratio);
+		worst.previous_us = std::max(worst.previous_us, result.previous_us);
+	}
+
+	return worst;
+}
+
+static void print(const char *name, const Result &result) {
+	char converged[32];
+
+	if (std::isnan(result.converged_s)) {
+		std::snprintf(converged, sizeof(converged), "never");
+	} else {
+		std::snprintf(converged, sizeof(converged), "%.0f s", result.converged_s);
+	}
+
+	std::printf("  %-12s %10.0f %10.0f %10.0f %12s %12u\n", name, result.rms_us,
+		result.p99_us, result.max_us, converged, result.adjustments);
+}
+
+} // namespace
+
+int main() {
+	static const Scenario scenarios[] = {
+		{ "Quiet network, +12ppm crystal", 12.0, 0.0, 1.0, 500.0, 0.0, 0.0, 3e6, 1000.0 },
+		{ "Quiet network, -40ppm crystal", -40.0, 0.0, 1.0, 500.0, 0.0, 0.0, 3e6, 1000.0 },
+		{ "Noisy network, +12ppm crystal", 12.0, 0.0, 1.0, 2000.0, 0.0, 0.0, 3e6, 4000.0 },
+		{ "Noisy network with outliers", 12.0, 0.0, 1.0, 2000.0, 0.03, 80000.0, 3e6, 4000.0 },
+		{ "Temperature drift +/-3ppm/6h", -20.0, 3.0, 6.0 * 3600.0, 1000.0, 0.01, 50000.0, 3e6, 2000.0 },
+	};
+
+	bool ok = true;
+
+	std::printf("Phase error at the start of each transmission in the second half"
+		" of %" PRIu64 " hours, and in holdover (without SNTP) for up to %" PRIu64
+		" hours with a limit of %.0fms\n\n", SIMULATION_S / 3600,
+		(SIMULATION_S - HOLDOVER_START_S - (HOLDOVER_STARTS - 1)
+			* HOLDOVER_START_INTERVAL_S) / 3600, HOLDOVER_LIMIT_US / 1000.0);
+
+	for (const auto &scenario : scenarios) {
+		std::printf("%s (converged: error within %.0fus)\n", scenario.name,
+			scenario.converged_us);
+		std::printf("  %-12s %10s %10s %10s %12s %12s\n", "", "RMS (us)",
+			"p99 (us)", "max (us)", "converged", "adjustments");
+		print("previous", simulate(scenario, Mode::PREVIOUS));
+		print("discipline", simulate(scenario, Mode::DISCIPLINE));
+
+		HoldoverResult holdover = simulate_holdover(scenario);
+
+		std::printf("  %-12s %10s %10s %10s %12s\n", "", "valid", "max (us)",
+			"error/bound", "3h (us)");
+		std::printf("  %-12s %8.1f h %10.0f %10.2f %12.0f\n", "holdover",
+			holdover.valid_s / 3600.0, holdover.max_us, holdover.max_ratio,
+			holdover.previous_us);
+		std::printf("\n");
+
+		if (holdover.max_ratio > 1.0) {
+			ok = false;
+		}
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for ClockDiscipline, checking that the frequency estimate
+ * survives the clock being stepped
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "clockson/discipline.h"
+
+using namespace clockson;
+
+namespace {
+
+static constexpr uint64_t POLL_US = 60000000;
+static constexpr double FREQUENCY_PPM = 20.0;
+static constexpr double NOISE_US = 1000.0;
+static constexpr unsigned int SAMPLES = 200;
+/* Maximum difference from the frequency error after converging */
+static constexpr double TOLERANCE_PPM = 1.0;
+
+static bool ok{true};
+
+static void check(const char *name, bool result) {
+	std::printf("%-52s %s\n", name, result ? "OK" : "FAIL");
+
+	if (!result) {
+		ok = false;
+	}
+}
+
+/*
+ * The system clock runs fast by FREQUENCY_PPM and is corrected by the
+ * adjustments before each poll
+ */
+class Clock {
+public:
+	/* Offset (reference time minus system time) at the next poll */
+	int64_t poll() {
+		uptime_us_ += POLL_US;
+		correction_us_ += discipline.adjustment(uptime_us_, INT64_MAX);
+		return std::llround(error_us() + noise_(rng_));
+	}
+
+	/* Step the system clock by offset_us */
+	void step(int64_t offset_us) {
+		correction_us_ += offset_us;
+		discipline.step(uptime_us_);
+	}
+
+	inline uint64_t uptime_us() const { return uptime_us_; }
+	inline double error_us() const {
+		return -(uptime_us_ * FREQUENCY_PPM / 1e6 + correction_us_);
+	}
+
+	ClockDiscipline discipline;
+
+private:
+	std::mt19937_64 rng_{1};
+	std::normal_distribution<double> noise_{0.0, NOISE_US};
+	uint64_t uptime_us_{0};
+	double correction_us_{0};
+};
+
+} // namespace
+
+int main() {
+	Clock clock;
+	bool kept = true;
+	double max_ppm = 0;
+
+	clock.step(clock.poll());
+
+	for (unsigned int i = 0; i < SAMPLES; i++) {
+		clock.discipline.sample(clock.uptime_us(), clock.poll());
+	}
+
+	const double before_ppm = clock.discipline.frequency_ppm();
+
+	check("Frequency estimate converges",
+		std::abs(before_ppm + FREQUENCY_PPM) < TOLERANCE_PPM);
+
+	/* Something else sets the clock, so NTP steps it back */
+	clock.step(-100000);
+	clock.step(clock.poll());
+
+	for (unsigned int i = 0; i < 10; i++) {
+		clock.discipline.sample(clock.uptime_us(), clock.poll());
+
+		const double error_ppm = std::abs(clock.discipline.frequency_ppm() - before_ppm);
+
+		max_ppm = std::max(max_ppm, error_ppm);
+		kept = kept && error_ppm < TOLERANCE_PPM;
+	}
+	check("Frequency estimate is kept after a step", kept);
+	check("Phase is corrected after a step", std::abs(clock.error_us()) < 4 * NOISE_US);
+
+	if (!kept) {
+		std::printf("  changed by up to %.3fppm after the step\n", max_ppm);
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
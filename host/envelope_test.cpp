@@ -0,0 +1,242 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for Envelope, checking the RMT symbols that are produced for
+ * each sequence of changes
+ */
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include "clockson/clock_mapping.h"
+#include "clockson/envelope.h"
+#include "clockson/time_signal.h"
+
+using namespace clockson;
+
+namespace {
+
+/* Duration and level */
+using Duration = std::pair<uint32_t, int>;
+
+/* 2024-01-01 00:00:00 UTC */
+static constexpr time_t Y2024_S = 1704067200;
+
+static constexpr uint32_t MAX_DURATION = Envelope::MAX_DURATION;
+
+static bool ok{true};
+
+/*
+ * Every duration of the symbols, which must not include 0 because that ends
+ * the transmission (unless it's the last one)
+ */
+static std::vector<Duration> durations(const Envelope &envelope, bool &valid) {
+	std::vector<Duration> result;
+
+	valid = true;
+
+	for (size_t i = 0; i < envelope.size(); i++) {
+		Envelope::symbol_t symbol = envelope.data()[i];
+
+		for (unsigned int shift : {0U, 16U}) {
+			uint32_t duration = (symbol >> shift) & MAX_DURATION;
+			int level = (symbol >> (shift + 15)) & 1U;
+
+			if (duration == 0 && (i != envelope.size() - 1 || shift == 0)) {
+				valid = false;
+			}
+
+			result.emplace_back(duration, level);
+		}
+	}
+
+	return result;
+}
+
+static void check(const char *name, bool result) {
+	std::printf("%-52s %s\n", name, result ? "OK" : "FAIL");
+
+	if (!result) {
+		ok = false;
+	}
+}
+
+/* The symbols, end time and end level are exactly as expected */
+static void check(const char *name, const Envelope &envelope,
+		const std::vector<Duration> &expected, uint64_t end_us, int end_level) {
+	bool valid;
+	auto actual = durations(envelope, valid);
+
+	check(name, valid && actual == expected && envelope.end_us() == end_us
+		&& envelope.end_level() == end_level
+		&& envelope.bytes() == envelope.size() * sizeof(Envelope::symbol_t));
+}
+
+/*
+ * Replay the symbols from start_us and compare the time of each change of
+ * level with the time signal
+ */
+static bool replay(const Envelope &envelope, TimeSignal signal,
+		uint64_t start_us, int active, int inactive) {
+	bool valid;
+	auto actual = durations(envelope, valid);
+	uint64_t ts_us = start_us;
+	int level = active;
+
+	if (!valid) {
+		return false;
+	}
+
+	for (const auto &duration : actual) {
+		if (duration.second != level) {
+			if (!signal.available() || signal.next().unsigned_ts() != ts_us
+					|| (signal.next().carrier ? active : inactive) != duration.second) {
+				return false;
+			}
+
+			level = duration.second;
+			signal.pop();
+		}
+
+		ts_us += duration.first;
+	}
+
+	/* The last change is the end level when the transmission finishes */
+	if (!signal.available() || signal.next().unsigned_ts() != ts_us
+			|| (signal.next().carrier ? active : inactive) != envelope.end_level()) {
+		return false;
+	}
+
+	signal.pop();
+	return !signal.available() && envelope.end_us() == ts_us;
+}
+
+} // namespace
+
+int main() {
+	static Envelope envelope;
+
+	envelope.begin(1000, 1);
+	check("No changes", !envelope.finish() && envelope.size() == 0);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	check("One change", envelope.finish());
+	check("One change (split in half)", envelope, {{50, 1}, {50, 1}}, 1100, 0);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	envelope.change(1300, 1);
+	envelope.finish();
+	check("Two changes", envelope, {{100, 1}, {200, 0}}, 1300, 1);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	envelope.change(1300, 1);
+	envelope.change(1301, 0);
+	envelope.finish();
+	check("Three changes (1us split in half)", envelope,
+		{{100, 1}, {200, 0}, {1, 1}, {0, 1}}, 1301, 0);
+
+	envelope.begin(1000, 1);
+	envelope.change(1000, 0);
+	envelope.change(1200, 1);
+	envelope.finish();
+	check("Change at the start time", envelope, {{100, 0}, {100, 0}}, 1200, 1);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	envelope.change(1100, 1);
+	envelope.change(1200, 0);
+	envelope.finish();
+	check("Two changes at the same time", envelope, {{100, 1}, {100, 1}}, 1200, 0);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	envelope.change(1050, 1);
+	envelope.change(1200, 0);
+	envelope.finish();
+	check("Change before the previous change", envelope, {{100, 1}, {100, 1}}, 1200, 0);
+
+	envelope.begin(0, 1);
+	envelope.change(MAX_DURATION, 0);
+	envelope.change(MAX_DURATION * 2, 1);
+	envelope.finish();
+	check("Maximum duration", envelope,
+		{{MAX_DURATION, 1}, {MAX_DURATION, 0}}, MAX_DURATION * 2, 1);
+
+	envelope.begin(0, 1);
+	envelope.change(MAX_DURATION + 1, 0);
+	envelope.finish();
+	check("Maximum duration + 1", envelope,
+		{{MAX_DURATION, 1}, {1, 1}}, MAX_DURATION + 1, 0);
+
+	envelope.begin(0, 0);
+	envelope.change(100000, 1);
+	envelope.change(100010, 0);
+	envelope.finish();
+	check("Long duration (split in 15 bits)", envelope,
+		{{MAX_DURATION, 0}, {MAX_DURATION, 0}, {MAX_DURATION, 0},
+			{100000 - MAX_DURATION * 3, 0}, {5, 1}, {5, 1}}, 100010, 0);
+
+	envelope.begin(0, 1);
+
+	bool full = false;
+
+	for (size_t i = 1; i <= Envelope::MAX_SYMBOLS * 2 + 1; i++) {
+		if (!envelope.change(i, i & 1)) {
+			full = i == Envelope::MAX_SYMBOLS * 2 + 1;
+			break;
+		}
+	}
+	check("Too many changes", full && envelope.size() == Envelope::MAX_SYMBOLS);
+
+	envelope.begin(1000, 1);
+	envelope.change(1100, 0);
+	envelope.change(1300, 1);
+	envelope.finish();
+	check("Shift start", envelope.shift_start(30));
+	check("Shift start (first duration)", envelope, {{70, 1}, {200, 0}}, 1300, 1);
+	check("Shift start by too much", !envelope.shift_start(100));
+	check("Shift start by too much (first duration)", envelope,
+		{{1, 1}, {200, 0}}, 1300, 1);
+
+	bool encoded = true;
+
+	for (time_t t = Y2024_S; t < Y2024_S + 86400; t += 60) {
+		TimeSignal signal{t, ClockMapping{1000000}};
+		uint64_t start_us = signal.next().unsigned_ts() - 500000;
+		TimeSignal copy = signal;
+
+		if (!envelope.encode(copy, start_us, 1, 0)
+				|| !replay(envelope, signal, start_us, 1, 0)) {
+			encoded = false;
+			break;
+		}
+	}
+	check("Encode every minute of 2024-01-01", encoded);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
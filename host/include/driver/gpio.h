@@ -0,0 +1,63 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulator stand-in for ESP-IDF's driver/gpio.h (virtual outputs) */
+
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef enum {
+	GPIO_NUM_NC = -1,
+	GPIO_NUM_0 = 0,
+	GPIO_NUM_MAX = 49,
+} gpio_num_t;
+
+typedef enum {
+	GPIO_MODE_DISABLE,
+	GPIO_MODE_INPUT,
+	GPIO_MODE_OUTPUT,
+} gpio_mode_t;
+
+typedef enum {
+	GPIO_PULLUP_DISABLE,
+	GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef enum {
+	GPIO_PULLDOWN_DISABLE,
+	GPIO_PULLDOWN_ENABLE,
+} gpio_pulldown_t;
+
+typedef enum {
+	GPIO_INTR_DISABLE,
+} gpio_int_type_t;
+
+typedef struct {
+	uint64_t pin_bit_mask;
+	gpio_mode_t mode;
+	gpio_pullup_t pull_up_en;
+	gpio_pulldown_t pull_down_en;
+	gpio_int_type_t intr_type;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+esp_err_t gpio_sleep_sel_dis(gpio_num_t gpio_num);
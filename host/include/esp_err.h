@@ -0,0 +1,43 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulator stand-in for ESP-IDF's esp_err.h */
+
+#pragma once
+
+#include <cstdint>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+
+const char *esp_err_to_name(esp_err_t code);
+[[noreturn]] void esp_error_check_failed(esp_err_t rc, const char *file,
+	int line, const char *function, const char *expression);
+
+#define ESP_ERROR_CHECK(x) do { \
+		esp_err_t err_rc_ = (x); \
+		if (err_rc_ != ESP_OK) { \
+			esp_error_check_failed(err_rc_, __FILE__, __LINE__, \
+				__func__, #x); \
+		} \
+	} while (0)
@@ -0,0 +1,42 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulator stand-in for ESP-IDF's esp_log.h */
+
+#pragma once
+
+#include <cinttypes>
+
+typedef enum {
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void esp_log_write(esp_log_level_t level, const char *tag,
+	const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOG_LEVEL(level, tag, format, ...) \
+	esp_log_write(level, tag, format, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
@@ -0,0 +1,34 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulator stand-in for FreeRTOS event_groups.h */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef TickType_t EventBits_t;
+typedef struct EventGroupDef_t *EventGroupHandle_t;
+typedef struct {
+	EventBits_t bits;
+} StaticEventGroup_t;
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+	BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks);
@@ -0,0 +1,28 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host simulator configuration, in place of the generated sdkconfig.h */
+
+#pragma once
+
+/* The default output driver (esp_timer and GPIO) */
+#define CONFIG_CLOCKSON_OUTPUT_TIMER 1
+#define CONFIG_CLOCKSON_TRANSMIT_CORE 0x1
+#define CONFIG_CLOCKSON_NETWORK_CORE 0x0
+#define CONFIG_LWIP_SNTP_UPDATE_DELAY 60000
+#define CONFIG_CLOCKSON_HOLDOVER_LIMIT_MS 500
@@ -0,0 +1,227 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for MsfDecoder, which must decode valid time signals and
+ * reject each kind of invalid one with the flag for that problem (and no
+ * other flags) so that the transmit simulation can rely on it.
+ */
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+
+#include "clockson/msf_decoder.h"
+#include "clockson/standard.h"
+
+using namespace clockson;
+
+namespace {
+
+using Frame = MsfDecoder::Frame;
+
+static constexpr int64_t ONE_SECOND_US = 1000000;
+static constexpr int64_t ONE_MILLISECOND_US = 1000;
+
+/*
+ * Second with the change in each test minute to shift or add a glitch after
+ * (one of the DUT1 bits, which are always 0) and how far to shift it
+ */
+static constexpr unsigned int SHIFT_SECOND = 10;
+static constexpr int64_t SHIFT_US = MsfDecoder::DEFAULT_TOLERANCE_US + 10000;
+
+/* Minutes with different fields and summer time bits */
+static constexpr time_t TEST_TIMES_S[] = {
+	/* 2024-01-01 12:34:00 UTC */
+	1704112440,
+	/* 2024-03-31 00:30:00 UTC (summer time starts in 30 minutes) */
+	1711845000,
+	/* 2024-07-01 18:59:00 UTC */
+	1719860340,
+	/* 2099-12-31 23:59:00 UTC */
+	4102444740,
+};
+
+/* How a test changes a minute before it's transmitted */
+struct Corruption {
+	/* Change to the frame */
+	std::function<void(Frame &)> frame;
+	/* Time to shift the change after the start of SHIFT_SECOND by */
+	int64_t shift_us;
+	/*
+	 * Time after that change to briefly change the carrier back for, so
+	 * that there are two more changes
+	 */
+	int64_t glitch_us;
+};
+
+/* Transmit a frame as the changes of the carrier, starting at start_us */
+static bool transmit(MsfDecoder &decoder, const Frame &frame, int64_t start_us,
+		int64_t shift_us = 0, int64_t glitch_us = 0) {
+	bool complete = false;
+	bool carrier = standard::MSF::FIRST_CARRIER;
+
+	for (unsigned int second = 0; second < 60; second++) {
+		const Symbol &symbol = standard::MSF::SYMBOLS[
+			standard::MSF::symbol_index(frame, second)];
+
+		for (unsigned int i = 0; i < symbol.count; i++) {
+			int64_t ts_us = start_us + second * ONE_SECOND_US
+				+ symbol.offset_ms[i] * ONE_MILLISECOND_US;
+
+			if (second == SHIFT_SECOND && i == 1) {
+				ts_us += shift_us;
+			}
+
+			complete |= decoder.edge(ts_us, carrier);
+
+			if (second == SHIFT_SECOND && i == 1 && glitch_us) {
+				complete |= decoder.edge(ts_us + glitch_us, !carrier);
+				complete |= decoder.edge(ts_us + 2 * glitch_us, carrier);
+			}
+
+			carrier = !carrier;
+		}
+	}
+
+	return complete;
+}
+
+static Frame encode(time_t t) {
+	Frame frame{};
+
+	standard::MSF::encode(frame, standard::MSF::Calendar{t}, nullptr);
+	return frame;
+}
+
+static bool ok{true};
+
+/*
+ * Transmit a valid minute, the minute at t with a corruption and then the
+ * valid minute after it (to complete it), checking that the errors of the
+ * corrupted minute are exactly the expected ones
+ */
+static void test(const char *name, uint16_t expected, const Corruption &corruption) {
+	unsigned int failures = 0;
+
+	for (time_t t : TEST_TIMES_S) {
+		MsfDecoder decoder;
+		Frame frame = encode(t);
+		const int64_t start_us = (t - 60) * ONE_SECOND_US;
+
+		if (corruption.frame) {
+			corruption.frame(frame);
+		}
+
+		transmit(decoder, encode(t - 60), start_us);
+		transmit(decoder, frame, start_us + 60 * ONE_SECOND_US,
+			corruption.shift_us, corruption.glitch_us);
+
+		if (!transmit(decoder, encode(t + 60), start_us + 120 * ONE_SECOND_US)) {
+			std::printf("%s: %" PRId64 " not complete\n", name, (int64_t)t);
+			failures++;
+			continue;
+		}
+
+		const MsfDecoder::Minute &minute = decoder.minute();
+
+		if (minute.errors != expected) {
+			std::printf("%s: %" PRId64 " errors 0x%02x, expected 0x%02x\n",
+				name, (int64_t)t, minute.errors, expected);
+			failures++;
+		} else if (expected == MsfDecoder::NONE && minute.utc_time != (uint64_t)t) {
+			std::printf("%s: %" PRId64 " decoded as %" PRIu64 "\n",
+				name, (int64_t)t, minute.utc_time);
+			failures++;
+		} else if (expected != MsfDecoder::NONE && minute.utc_time != 0) {
+			std::printf("%s: %" PRId64 " decoded as %" PRIu64 " with errors\n",
+				name, (int64_t)t, minute.utc_time);
+			failures++;
+		}
+	}
+
+	std::printf("%-44s %s\n", name, failures ? "FAIL" : "OK");
+
+	if (failures) {
+		ok = false;
+	}
+}
+
+} // namespace
+
+int main() {
+	test("Valid", MsfDecoder::NONE, {});
+
+	test("Change shifted within tolerance", MsfDecoder::NONE,
+		{{}, MsfDecoder::DEFAULT_TOLERANCE_US - 1000, 0});
+
+	test("Change shifted beyond tolerance", MsfDecoder::PULSE_WIDTH, {{}, SHIFT_US, 0});
+
+	test("Change shifted back beyond tolerance", MsfDecoder::PULSE_WIDTH,
+		{{}, -SHIFT_US, 0});
+
+	/* All three changes are within the tolerance of the same 100ms step */
+	test("Glitch within a step", MsfDecoder::SYMBOL, {{}, 0, 5000});
+
+	test("Parity bit B54 flipped", MsfDecoder::PARITY, {[] (Frame &frame) {
+		frame.b.flip(54);
+	}, 0, 0});
+
+	test("Parity bit B57 flipped", MsfDecoder::PARITY, {[] (Frame &frame) {
+		frame.b.flip(57);
+	}, 0, 0});
+
+	test("Minute identifier A53 cleared", MsfDecoder::IDENTIFIER, {[] (Frame &frame) {
+		frame.a[53] = false;
+	}, 0, 0});
+
+	test("Minute identifier A59 set", MsfDecoder::IDENTIFIER, {[] (Frame &frame) {
+		frame.a[59] = true;
+	}, 0, 0});
+
+	/* The parity bits are corrected so that only the BCD value is invalid */
+	test("Minute units 10", MsfDecoder::BCD, {[] (Frame &frame) {
+		frame.a[48] = true;
+		frame.a[49] = false;
+		frame.a[50] = true;
+		frame.a[51] = false;
+		frame.b[57] = standard::odd_parity(frame.a, 39, 51);
+	}, 0, 0});
+
+	test("Month units 15", MsfDecoder::BCD, {[] (Frame &frame) {
+		for (size_t i = 26; i <= 29; i++) {
+			frame.a[i] = true;
+		}
+
+		frame.b[55] = standard::odd_parity(frame.a, 25, 35);
+	}, 0, 0});
+
+	test("Summer time warning B53 flipped", MsfDecoder::CALENDAR, {[] (Frame &frame) {
+		frame.b.flip(53);
+	}, 0, 0});
+
+	test("Summer time B58 flipped", MsfDecoder::CALENDAR, {[] (Frame &frame) {
+		frame.b.flip(58);
+	}, 0, 0});
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,296 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host test of the NTP client against stand-in NTP servers on the loopback
+ * interface, with injected network delays (including asymmetric delays that
+ * can't be measured) and clock errors. The combined offset is compared with
+ * trusting the samples from any one server.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "clockson/ntp.h"
+
+using namespace clockson;
+
+namespace {
+
+/* Error of the client's clock, which should be measured as the offset */
+static constexpr int64_t CLIENT_ERROR_US = 123456;
+static constexpr unsigned int POLLS = 64;
+static constexpr uint32_t POLL_TIMEOUT_MS = 500;
+static constexpr uint64_t EPOCH_OFFSET_S = 2208988800ULL;
+
+struct Config {
+	const char *name;
+	/* Error of the server's clock */
+	int64_t error_us;
+	/* Delay from the client to the server */
+	uint32_t request_min_us;
+	uint32_t request_max_us;
+	/* Delay from the server to the client */
+	uint32_t response_min_us;
+	uint32_t response_max_us;
+	/* Occasional queueing delay in either direction */
+	double queue_rate;
+	uint32_t queue_max_us;
+};
+
+struct Errors {
+	std::vector<double> values;
+
+	void add(double value) { values.push_back(value); }
+
+	void print(const char *name) const {
+		double sum = 0.0;
+		double max = 0.0;
+
+		for (double value : values) {
+			sum += value * value;
+			max = std::max(max, std::abs(value));
+		}
+
+		std::printf("  %-36s %10zu %10.0f %10.0f\n", name, values.size(),
+			values.empty() ? NAN : std::sqrt(sum / values.size()),
+			values.empty() ? NAN : max);
+	}
+};
+
+static uint64_t realtime_us() {
+	struct timespec ts{};
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000U;
+}
+
+static uint64_t client_wall_us() {
+	return realtime_us() + CLIENT_ERROR_US;
+}
+
+static uint64_t client_uptime_us() {
+	struct timespec ts{};
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000U;
+}
+
+static int64_t client_applied_us() {
+	return 0;
+}
+
+static void write_ts(uint8_t *data, uint64_t wall_us) {
+	uint64_t value = ((wall_us / 1000000U + EPOCH_OFFSET_S) << 32)
+		| (((wall_us % 1000000U) << 32) / 1000000U);
+
+	for (int i = 7; i >= 0; i--) {
+		data[i] = value & 0xFFU;
+		value >>= 8;
+	}
+}
+
+class StandIn {
+public:
+	StandIn(const Config &config, unsigned int seed) : config_(config), rng_(seed) {
+		struct sockaddr_in addr{};
+		socklen_t len = sizeof(addr);
+
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		socket_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (socket_ == -1
+				|| ::bind(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))
+				|| ::getsockname(socket_, reinterpret_cast<struct sockaddr*>(&addr_), &len)) {
+			std::perror("stand-in socket");
+			std::exit(EXIT_FAILURE);
+		}
+
+		struct timeval timeout{0, 100000};
+
+		::setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		thread_ = std::thread{[this] { run(); }};
+	}
+
+	~StandIn() {
+		stop_ = true;
+		thread_.join();
+		::close(socket_);
+	}
+
+	inline const struct sockaddr_in& address() const { return addr_; }
+	inline const Config& config() const { return config_; }
+
+private:
+	uint32_t delay_us(uint32_t min_us, uint32_t max_us) {
+		std::uniform_int_distribution<uint32_t> delay{min_us, max_us};
+		std::uniform_real_distribution<double> uniform{0.0, 1.0};
+		uint32_t value = delay(rng_);
+
+		if (uniform(rng_) < config_.queue_rate) {
+			value += uniform(rng_) * config_.queue_max_us;
+		}
+
+		return value;
+	}
+
+	void run() {
+		while (!stop_) {
+			std::array<uint8_t, 48> packet;
+			struct sockaddr_in from{};
+			socklen_t from_len = sizeof(from);
+
+			if (::recvfrom(socket_, packet.data(), packet.size(), 0,
+					reinterpret_cast<struct sockaddr*>(&from), &from_len) != (ssize_t)packet.size()) {
+				continue;
+			}
+
+			/* The request arrives late... */
+			std::this_thread::sleep_for(std::chrono::microseconds{
+				delay_us(config_.request_min_us, config_.request_max_us)});
+
+			std::array<uint8_t, 48> response{};
+
+			/* No leap second warning, version 4, server mode, stratum 1 */
+			response[0] = (0 << 6) | (4 << 3) | 4;
+			response[1] = 1;
+			std::copy(&packet[40], &packet[48], &response[24]);
+			write_ts(&response[32], realtime_us() + config_.error_us);
+			write_ts(&response[40], realtime_us() + config_.error_us);
+
+			/* ...and the response is sent late */
+			std::this_thread::sleep_for(std::chrono::microseconds{
+				delay_us(config_.response_min_us, config_.response_max_us)});
+
+			::sendto(socket_, response.data(), response.size(), 0,
+				reinterpret_cast<struct sockaddr*>(&from), from_len);
+		}
+	}
+
+	const Config config_;
+	std::mt19937 rng_;
+	int socket_{-1};
+	struct sockaddr_in addr_{};
+	std::atomic<bool> stop_{false};
+	std::thread thread_;
+};
+
+static const char *state_name(NtpServer::State state) {
+	switch (state) {
+	case NtpServer::State::NONE: return "unused";
+	case NtpServer::State::FALSETICKER: return "falseticker";
+	case NtpServer::State::OUTLIER: return "outlier";
+	case NtpServer::State::SURVIVOR: return "survivor";
+	}
+
+	return "?";
+}
+
+} // namespace
+
+int main() {
+	static const Config configs[] = {
+		{ "symmetric 1-3ms", 0, 1000, 3000, 1000, 3000, 0.0, 0 },
+		{ "asymmetric +4ms", 0, 5000, 7000, 1000, 3000, 0.0, 0 },
+		{ "asymmetric -3ms", 0, 1000, 2000, 4000, 5000, 0.0, 0 },
+		{ "queueing 25% up to 20ms", 0, 500, 1500, 500, 1500, 0.25, 20000 },
+		{ "falseticker +25ms", 25000, 1000, 3000, 1000, 3000, 0.0, 0 },
+	};
+	std::vector<std::unique_ptr<StandIn>> servers;
+	NtpClient client{client_wall_us, client_uptime_us, client_applied_us};
+	std::vector<Errors> raw(std::size(configs));
+	std::vector<Errors> filtered(std::size(configs));
+	Errors combined;
+	unsigned int falsetickers = 0;
+
+	for (size_t i = 0; i < std::size(configs); i++) {
+		servers.push_back(std::make_unique<StandIn>(configs[i], i + 1));
+		client.server(i, &servers[i]->address());
+	}
+
+	for (unsigned int poll = 0; poll < POLLS; poll++) {
+		const uint64_t start_us = client_uptime_us();
+
+		if (!client.poll(POLL_TIMEOUT_MS)) {
+			std::fprintf(stderr, "Poll %u discarded\n", poll);
+			continue;
+		}
+
+		for (size_t i = 0; i < std::size(configs); i++) {
+			const NtpServer &server = client.server(i);
+
+			if (server.valid() && server.last().uptime_us >= start_us) {
+				/* Trusting the latest sample, as SNTP does */
+				raw[i].add(server.last().offset_us + CLIENT_ERROR_US);
+				filtered[i].add(server.best().offset_us + CLIENT_ERROR_US);
+			}
+		}
+
+		NtpSelection selection = client.select();
+
+		if (selection.valid) {
+			combined.add(selection.offset_us + CLIENT_ERROR_US);
+			falsetickers += selection.falsetickers;
+		}
+	}
+
+	std::printf("Offset error over %u polls of %zu stand-in servers\n\n",
+		POLLS, std::size(configs));
+	std::printf("  %-36s %10s %10s %10s\n", "", "samples", "RMS (us)", "max (us)");
+
+	for (size_t i = 0; i < std::size(configs); i++) {
+		char name[64];
+
+		std::snprintf(name, sizeof(name), "%s (latest)", configs[i].name);
+		raw[i].print(name);
+		std::snprintf(name, sizeof(name), "%s (filtered)", configs[i].name);
+		filtered[i].print(name);
+	}
+
+	std::printf("\n");
+	combined.print("combined");
+	std::printf("\nFalsetickers rejected: %u\n", falsetickers);
+	std::printf("Final state:");
+
+	for (size_t i = 0; i < std::size(configs); i++) {
+		std::printf(" %s", state_name(client.server(i).state()));
+	}
+
+	std::printf("\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for the conversion of NTP timestamps, which have to be in the
+ * right era before the system clock has been synced
+ */
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "clockson/ntp.h"
+
+using namespace clockson;
+
+namespace {
+
+static constexpr uint64_t ONE_SECOND_US = 1000000;
+/* Unix times */
+static constexpr uint64_t Y2024_US = 1704067200 * ONE_SECOND_US;
+static constexpr uint64_t Y2040_US = 2208988800 * ONE_SECOND_US;
+static constexpr uint64_t Y2100_US = 4102444800 * ONE_SECOND_US;
+static constexpr uint64_t Y2120_US = 4733510400 * ONE_SECOND_US;
+static constexpr uint64_t Y2150_US = 5680281600 * ONE_SECOND_US;
+
+static bool ok{true};
+
+/* Decode the NTP timestamp ts (within the 1us resolution) */
+static void check_ntp(const char *name, uint64_t ts, uint64_t reference_us,
+		uint64_t expected_us) {
+	const uint64_t actual_us = NtpClient::from_ntp(ts, reference_us);
+	const bool result = actual_us <= expected_us && actual_us + 1 >= expected_us;
+
+	std::printf("%-52s %s\n", name, result ? "OK" : "FAIL");
+
+	if (!result) {
+		std::printf("  expected %" PRIu64 "us, actual %" PRIu64 "us\n",
+			expected_us, actual_us);
+		ok = false;
+	}
+}
+
+/* Decode the NTP timestamp for wall_us */
+static void check(const char *name, uint64_t wall_us, uint64_t reference_us,
+		uint64_t expected_us) {
+	check_ntp(name, NtpClient::to_ntp(wall_us), reference_us, expected_us);
+}
+
+} // namespace
+
+int main() {
+	check("2024 before sync", Y2024_US + 123456, 0, Y2024_US + 123456);
+	check("2040 before sync", Y2040_US + 654321, 0, Y2040_US + 654321);
+	check("2100 before sync", Y2100_US, 0, Y2100_US);
+	check("2024 after sync", Y2024_US, Y2024_US + 3600 * ONE_SECOND_US, Y2024_US);
+	check("2040 after sync", Y2040_US, Y2024_US, Y2040_US);
+	check("2150 after sync", Y2150_US + 999999, Y2120_US, Y2150_US + 999999);
+	/* 1969-12-31 00:00:00 UTC */
+	check_ntp("Before 1970", (uint64_t)2208902400 << 32, 0, 0);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,243 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for the keying schedule, which is the sequence of changes
+ * that the transmit drivers apply to each output (setting the output level
+ * or keying the generated carrier on/off). For every combination of
+ * enabled outputs the changes for each output must be exactly the changes
+ * of its own time signal, in time order, and every change must alternate
+ * the carrier so that each one keys the output. The longest time between
+ * changes of each output must be the one that its standard declares, which
+ * is used to check that the outputs are still changing.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <tuple>
+#include <vector>
+
+#include "clockson/clock_mapping.h"
+#include "clockson/schedule.h"
+#include "clockson/standard.h"
+#include "clockson/time_signal.h"
+
+using namespace clockson;
+
+namespace {
+
+/* The same outputs as the transmitter */
+using TestSchedule = Schedule<standard::MSF, standard::DCF77,
+	standard::WWVB, standard::JJY>;
+
+/* 2024-01-01 00:00:00 UTC */
+static constexpr time_t Y2024_S = 1704067200;
+/* 2024-03-31 00:00:00 UTC */
+static constexpr time_t Y2024_SUMMER_S = 1711843200;
+/* 2025-01-01 00:00:00 UTC */
+static constexpr time_t Y2025_S = 1735689600;
+static constexpr time_t ONE_DAY_S = 24 * 3600;
+
+/* Maximum number of differences to print */
+static constexpr unsigned int MAX_REPORTS = 20;
+
+/* Uptime started just before 2024 and has a frequency error of 10ppm */
+static constexpr ClockMapping CLOCK{Y2024_S * 1000000ULL, 1000000,
+	ClockMapping::rate_from_frequency(10e-6)};
+
+class KeyingTest {
+public:
+	/*
+	 * Transmit every minute from begin_s to end_s with the outputs in
+	 * enabled, continuing from one minute to the next like the transmitter
+	 */
+	void run(const std::array<bool, TestSchedule::SIZE> &enabled,
+			time_t begin_s, time_t end_s) {
+		TestSchedule schedule{enabled};
+		std::array<std::vector<Signal>, TestSchedule::SIZE> keyed;
+		std::array<Last, TestSchedule::SIZE> last{};
+
+		schedule.start(begin_s, CLOCK);
+
+		auto signals = std::make_tuple(
+			BasicTimeSignal<standard::MSF>::at_minute(begin_s, CLOCK),
+			BasicTimeSignal<standard::DCF77>::at_minute(begin_s, CLOCK),
+			BasicTimeSignal<standard::WWVB>::at_minute(begin_s, CLOCK),
+			BasicTimeSignal<standard::JJY>::at_minute(begin_s, CLOCK));
+
+		for (time_t t = begin_s; t < end_s; t += 60) {
+			int64_t previous_ts = INT64_MIN;
+
+			for (auto &changes : keyed) {
+				changes.clear();
+			}
+
+			while (schedule.available()) {
+				Signal signal = schedule.next();
+				size_t output = schedule.output();
+
+				if (!enabled[output]) {
+					report(t, "change for disabled output %zu", output);
+				}
+
+				if (signal.ts < previous_ts) {
+					report(t, "output %zu change at %" PRId64 " before %" PRId64,
+						output, signal.ts, previous_ts);
+				}
+
+				if (last[output].valid && last[output].carrier == signal.carrier) {
+					report(t, "output %zu change at %" PRId64 " doesn't key the carrier",
+						output, signal.ts);
+				}
+
+				if (last[output].valid) {
+					int64_t gap_us = signal.ts - last[output].ts;
+
+					if (gap_us > max_gap_us(output) + 1) {
+						report(t, "output %zu change at %" PRId64 " is %" PRId64 "us after the last one",
+							output, signal.ts, gap_us);
+					}
+
+					longest_gap_us_[output] = std::max(longest_gap_us_[output], gap_us);
+				}
+
+				previous_ts = signal.ts;
+				last[output] = {true, signal.carrier, signal.ts};
+				keyed[output].push_back(signal);
+				schedule.pop();
+			}
+
+			compare<0>(enabled, keyed, std::get<0>(signals), t);
+			compare<1>(enabled, keyed, std::get<1>(signals), t);
+			compare<2>(enabled, keyed, std::get<2>(signals), t);
+			compare<3>(enabled, keyed, std::get<3>(signals), t);
+
+			schedule.next_minute(CLOCK);
+			std::apply([] (auto&... signal) {
+				((signal = signal.next_minute(CLOCK)), ...);
+			}, signals);
+			minutes_++;
+		}
+	}
+
+	/* Check that the longest gap for each output was seen at least once */
+	void check_gaps() {
+		for (size_t output = 0; output < TestSchedule::SIZE; output++) {
+			if (longest_gap_us_[output] < max_gap_us(output) - 1) {
+				report(0, "output %zu longest gap %" PRId64 "us, expected %" PRId64 "us",
+					output, longest_gap_us_[output], max_gap_us(output));
+			}
+		}
+	}
+
+	inline uint64_t minutes() const { return minutes_; }
+	inline uint64_t failures() const { return failures_; }
+
+private:
+	struct Last {
+		bool valid;
+		bool carrier;
+		int64_t ts;
+	};
+
+	/* Longest gap declared for an output, in uptime */
+	static int64_t max_gap_us(size_t output) {
+		std::array<bool, TestSchedule::SIZE> enabled{};
+
+		enabled[output] = true;
+		return CLOCK.elapsed(TestSchedule{enabled}.max_gap_us());
+	}
+
+	template <size_t Output, class Standard>
+	void compare(const std::array<bool, TestSchedule::SIZE> &enabled,
+			const std::array<std::vector<Signal>, TestSchedule::SIZE> &keyed,
+			BasicTimeSignal<Standard> signal, time_t t) {
+		const auto &changes = keyed[Output];
+		size_t i = 0;
+
+		if (!enabled[Output]) {
+			return;
+		}
+
+		for (; signal.available(); signal.pop(), i++) {
+			if (i == changes.size()) {
+				report(t, "%s missing change %zu at %" PRId64, Standard::NAME,
+					i, signal.next().ts);
+				return;
+			}
+
+			if (changes[i].ts != signal.next().ts
+					|| changes[i].carrier != signal.next().carrier) {
+				report(t, "%s change %zu at %" PRId64 " carrier %d, expected %" PRId64 " carrier %d",
+					Standard::NAME, i, changes[i].ts, changes[i].carrier,
+					signal.next().ts, signal.next().carrier);
+				return;
+			}
+		}
+
+		if (i != changes.size()) {
+			report(t, "%s has %zu extra changes", Standard::NAME, changes.size() - i);
+		}
+	}
+
+	template <class... Args>
+	void report(time_t t, const char *format, Args... args) {
+		if (++failures_ <= MAX_REPORTS) {
+			std::printf("%" PRId64 ": ", static_cast<int64_t>(t));
+			std::printf(format, args...);
+			std::printf("\n");
+		}
+	}
+
+	std::array<int64_t, TestSchedule::SIZE> longest_gap_us_{};
+	uint64_t minutes_{0};
+	uint64_t failures_{0};
+};
+
+} // namespace
+
+int main() {
+	KeyingTest test;
+
+	/* Every minute of a year with all outputs enabled */
+	test.run({true, true, true, true}, Y2024_S, Y2025_S);
+
+	/* Every other combination of outputs around a summer time change */
+	for (unsigned int mask = 1; mask < (1U << TestSchedule::SIZE) - 1; mask++) {
+		std::array<bool, TestSchedule::SIZE> enabled{};
+
+		for (size_t i = 0; i < TestSchedule::SIZE; i++) {
+			enabled[i] = (mask & (1U << i)) != 0;
+		}
+
+		test.run(enabled, Y2024_SUMMER_S, Y2024_SUMMER_S + ONE_DAY_S);
+	}
+
+	test.check_gaps();
+
+	std::printf("%" PRIu64 " minutes compared, %" PRIu64 " differences\n",
+		test.minutes(), test.failures());
+
+	return test.failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host tests for building the time signal for each minute, which happens on
+ * the device for every minute that is transmitted and must not allocate
+ * from the heap. The time signals built incrementally from the previous
+ * minute are compared with a full build of the same minute.
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+
+#include "clockson/clock_mapping.h"
+#include "clockson/schedule.h"
+#include "clockson/standard.h"
+#include "clockson/time_signal.h"
+
+using namespace clockson;
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+/* Count every heap allocation */
+static uint64_t allocations;
+
+void *operator new(size_t size) {
+	void *ptr = std::malloc(size ? size : 1);
+
+	allocations++;
+
+	if (!ptr) {
+		throw std::bad_alloc{};
+	}
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+namespace {
+
+/* 1970-01-01 00:00:00 UTC */
+static constexpr time_t Y1970_S = 0;
+/* 2024-01-01 00:00:00 UTC */
+static constexpr time_t Y2024_S = 1704067200;
+/* 2025-01-01 00:00:00 UTC */
+static constexpr time_t Y2025_S = 1735689600;
+/* 3001-01-01 00:00:00 UTC */
+static constexpr time_t Y3001_S = 32535216000;
+static constexpr uint64_t MINUTES = (Y2025_S - Y2024_S) / 60;
+
+/*
+ * Interval for comparing incremental builds with full builds from 1970 to
+ * 3000 at a different time of day each day
+ */
+static constexpr time_t DAILY_INTERVAL_S = 24 * 3600 + 61 * 60;
+
+/* Maximum number of differences to print */
+static constexpr unsigned int MAX_REPORTS = 20;
+
+static constexpr ClockMapping CLOCK{1000000};
+
+/*
+ * Maximum average time to build a minute for one output, including
+ * iterating over all of its changes. This is ~10x more than it takes on the
+ * host so that it only fails if the build becomes much more expensive.
+ */
+static constexpr double BUILD_LIMIT_NS = 10000.0;
+
+/* Accumulate results so that the compiler can't discard the work */
+static volatile uint64_t sink;
+
+static bool ok{true};
+
+/*
+ * Build every minute of 2024 with func(t) for the number of outputs,
+ * checking that nothing is allocated and that the average time to build
+ * each minute is below the limit
+ */
+template <class F>
+static void test(const char *name, unsigned int outputs, F &&func) {
+	uint64_t before = allocations;
+	uint64_t result = 0;
+	auto start = steady_clock::now();
+
+	for (time_t t = Y2024_S; t < Y2025_S; t += 60) {
+		result += func(t);
+	}
+
+	auto elapsed = duration<double, std::nano>(steady_clock::now() - start);
+	double per_minute_ns = elapsed.count() / MINUTES;
+	uint64_t count = allocations - before;
+	bool pass = count == 0 && per_minute_ns < BUILD_LIMIT_NS * outputs;
+
+	sink = sink + result;
+
+	std::printf("%-44s %12" PRIu64 " %10.2f ns/min  %s\n", name, count,
+		per_minute_ns, pass ? "OK" : "FAIL");
+
+	if (!pass) {
+		ok = false;
+	}
+}
+
+template <class Signal>
+static uint64_t drain(Signal &signal) {
+	uint64_t result = 0;
+
+	while (signal.available()) {
+		result += signal.next().ts;
+		signal.pop();
+	}
+
+	return result;
+}
+
+/* Every change of both time signals is the same */
+template <class Standard>
+static bool same(BasicTimeSignal<Standard> a, BasicTimeSignal<Standard> b) {
+	if (a.time().utc_time() != b.time().utc_time()) {
+		return false;
+	}
+
+	while (a.available() && b.available()) {
+		if (a.next().ts != b.next().ts || a.next().carrier != b.next().carrier) {
+			return false;
+		}
+
+		a.pop();
+		b.pop();
+	}
+
+	return a.available() == b.available();
+}
+
+class NextMinuteTest {
+public:
+	/*
+	 * Build the time signals for every minute from begin_s to end_s
+	 * incrementally from the previous minute
+	 */
+	void chain(time_t begin_s, time_t end_s) {
+		check_chain<standard::MSF>(begin_s, end_s);
+		check_chain<standard::DCF77>(begin_s, end_s);
+		check_chain<standard::WWVB>(begin_s, end_s);
+		check_chain<standard::JJY>(begin_s, end_s);
+	}
+
+	/*
+	 * Build the time signal for the minute after each interval from begin_s
+	 * to end_s incrementally
+	 */
+	void step(time_t begin_s, time_t end_s, time_t interval_s) {
+		for (time_t t = begin_s; t < end_s; t += interval_s) {
+			check_step<standard::MSF>(t);
+			check_step<standard::DCF77>(t);
+			check_step<standard::WWVB>(t);
+			check_step<standard::JJY>(t);
+		}
+	}
+
+	inline uint64_t checked() const { return checked_; }
+	inline uint64_t failures() const { return failures_; }
+
+private:
+	template <class Standard>
+	void check(const BasicTimeSignal<Standard> &signal, time_t t) {
+		auto expected = BasicTimeSignal<Standard>::at_minute(t, CLOCK);
+
+		checked_++;
+
+		if (!same(signal, expected) && ++failures_ <= MAX_REPORTS) {
+			std::printf("%s next_minute() %s, expected %s\n", Standard::NAME,
+				signal.time().to_string().data(),
+				expected.time().to_string().data());
+		}
+	}
+
+	template <class Standard>
+	void check_chain(time_t begin_s, time_t end_s) {
+		auto signal = BasicTimeSignal<Standard>::at_minute(begin_s, CLOCK);
+
+		for (time_t t = begin_s + 60; t < end_s; t += 60) {
+			signal = signal.next_minute(CLOCK);
+			check(signal, t);
+		}
+	}
+
+	template <class Standard>
+	void check_step(time_t t) {
+		t = t / 60 * 60;
+		check(BasicTimeSignal<Standard>::at_minute(t, CLOCK).next_minute(CLOCK), t + 60);
+	}
+
+	uint64_t checked_{0};
+	uint64_t failures_{0};
+};
+
+} // namespace
+
+int main() {
+	std::printf("%-44s %12s %17s\n", "test", "allocations", "per minute");
+
+	test("TimeSignal(time_t, ClockMapping)", 1, [] (time_t t) {
+		TimeSignal signal{t, CLOCK};
+
+		return drain(signal);
+	});
+
+	test("BasicTimeSignal<DCF77>(time_t, ClockMapping)", 1, [] (time_t t) {
+		BasicTimeSignal<standard::DCF77> signal{t, CLOCK};
+
+		return drain(signal);
+	});
+
+	static TimeSignal previous{Y2024_S - 60, CLOCK};
+
+	test("TimeSignal::next_minute", 1, [] (time_t) {
+		previous = previous.next_minute(CLOCK);
+
+		TimeSignal signal{previous};
+
+		return drain(signal);
+	});
+
+	static Schedule<standard::MSF, standard::DCF77, standard::WWVB, standard::JJY>
+		schedule{{true, true, true, true}};
+
+	schedule.start(Y2024_S - 60, CLOCK);
+
+	test("Schedule::next_minute (4 standards)", 4, [] (time_t) {
+		schedule.next_minute(CLOCK);
+		return drain(schedule);
+	});
+
+	NextMinuteTest next_minute;
+
+	next_minute.chain(Y2024_S, Y2025_S);
+	next_minute.step(Y1970_S, Y3001_S, DAILY_INTERVAL_S);
+
+	std::printf("%" PRIu64 " incremental builds compared, %" PRIu64 " differences\n",
+		next_minute.checked(), next_minute.failures());
+
+	if (next_minute.failures()) {
+		ok = false;
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,835 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Deterministic host simulation of Transmit, with virtual time for esp_timer,
+ * the system clock and the output GPIO so that years of time signals can be
+ * generated in seconds. The real Transmit, TimeSignal and Network time
+ * keeping code is used, with NTP offsets from a simulated reference clock.
+ * Tasks run in their own threads, but only one thing runs at a time.
+ * Every minute of output is decoded with MsfDecoder and checked against the
+ * time from libc.
+ */
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <numbers>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clockson/civil.h"
+#include "clockson/msf_decoder.h"
+#include "clockson/network.h"
+#include "clockson/transmit.h"
+
+using namespace clockson;
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+struct esp_timer {
+	esp_timer_cb_t callback;
+	void *arg;
+	bool armed;
+	uint64_t expiry_us;
+};
+
+struct tskTaskControlBlock {
+	TaskFunction_t function;
+	void *arg;
+	/* Time to resume the task (if it's not notified before then) */
+	uint64_t wake_us;
+	uint32_t notifications;
+	bool running;
+};
+
+namespace {
+
+static constexpr int64_t ONE_SECOND_US = 1000000;
+static constexpr int64_t ONE_MINUTE_US = 60 * ONE_SECOND_US;
+static constexpr gpio_num_t MSF_GPIO = static_cast<gpio_num_t>(1);
+/* Delay before a notified task runs */
+static constexpr uint64_t TASK_LATENCY_US = 100;
+
+/* First NTP offset after boot, then at the configured interval */
+static constexpr uint64_t NTP_FIRST_US = 3 * ONE_SECOND_US;
+static constexpr uint64_t NTP_INTERVAL_US = CONFIG_LWIP_SNTP_UPDATE_DELAY * 1000ULL;
+
+/*
+ * Output changes are judged only while the system clock is within this of
+ * the reference time, otherwise they're counted as disturbed (e.g. after a
+ * clock step until NTP has corrected it)
+ */
+static constexpr int64_t DISTURBED_US = 10000;
+/*
+ * Minutes without any output are only allowed while the system clock is
+ * further than this from the reference time or there are no NTP offsets
+ */
+static constexpr int64_t HOLDOVER_LIMIT_US = Network::TIME_ERROR_LIMIT_US;
+/* Maximum error of every output change from the reference time */
+static constexpr int64_t TIMING_LIMIT_US = 20000;
+
+/* Change of the system clock that isn't made by Network */
+struct Step {
+	uint64_t uptime_s;
+	int64_t step_us;
+};
+
+struct Scenario {
+	const char *name;
+	/* Reference time at boot */
+	int64_t start_s;
+	uint64_t duration_s;
+	/* Crystal frequency error, uptime runs fast by this */
+	double frequency_ppm;
+	/* Change of the frequency error, varying sinusoidally with temperature */
+	double temperature_ppm;
+	double temperature_period_s;
+	/* NTP measurement noise */
+	double noise_us;
+	/* Mean delay of each timer callback, with occasional long delays */
+	uint64_t latency_us;
+	/* Uptime when the NTP offsets stop (holdover), 0 if they don't */
+	uint64_t holdover_s;
+	std::vector<Step> steps;
+};
+
+struct Result {
+	uint64_t ok;
+	uint64_t invalid;
+	uint64_t disturbed;
+	uint64_t missing;
+	uint64_t changes;
+	uint64_t late_changes;
+	int64_t max_error_us;
+	/* Time encoded by the last valid minute */
+	time_t last_s;
+};
+
+/*
+ * Decode MSF from the carrier changes, using the reference time of each
+ * change, and check every minute against the time from libc
+ */
+class Decoder {
+public:
+	/* Two digit years are from base_year */
+	explicit Decoder(unsigned int base_year) : msf_(base_year) {}
+
+	void edge(int64_t ts_us, bool carrier, bool disturbed);
+
+	/*
+	 * The system clock was wrong at this time, so the time signals that are
+	 * being transmitted and prepared (up to a minute in advance) may be too
+	 */
+	void disturbed(int64_t ts_us);
+
+	/*
+	 * The time signals around this time may not be transmitted, because the
+	 * system clock was too wrong or there were no NTP offsets
+	 */
+	void stopped(int64_t ts_us);
+
+	Result finish();
+
+private:
+	using bits_t = std::bitset<60>;
+
+	static void set_bcd(bits_t &bits, size_t begin, size_t end, unsigned int value);
+	static bool odd_parity(const bits_t &bits, size_t begin, size_t end);
+	static bool uk_summer(time_t t);
+
+	void end_minute(const MsfDecoder::Minute &minute);
+	bool check(const MsfDecoder::Frame &frame, time_t t) const;
+
+	MsfDecoder msf_;
+	bool carrier_{true};
+
+	/* Time encoded by every valid minute, in order */
+	std::vector<time_t> ok_;
+	/* Time that would be encoded by every minute with output changes */
+	std::set<time_t> transmitted_;
+	std::set<time_t> disturbed_;
+	std::set<time_t> stopped_;
+	time_t last_s_{0};
+	Result result_{};
+};
+
+void Decoder::edge(int64_t ts_us, bool carrier, bool disturbed) {
+	if (carrier == carrier_) {
+		return;
+	}
+
+	carrier_ = carrier;
+	transmitted_.insert(ts_us / ONE_MINUTE_US * 60 + 60);
+
+	/* Every change is on a multiple of 100ms */
+	int64_t error_us = ts_us - (ts_us + 50000) / 100000 * 100000;
+
+	/* Changes in minutes that were prepared while the clock was wrong aren't judged */
+	if (!disturbed && !disturbed_.contains(ts_us / ONE_MINUTE_US * 60 + 60)) {
+		result_.changes++;
+		result_.max_error_us = std::max(result_.max_error_us, std::abs(error_us));
+
+		if (std::abs(error_us) > TIMING_LIMIT_US) {
+			result_.late_changes++;
+		}
+	}
+
+	if (msf_.edge(ts_us, carrier)) {
+		end_minute(msf_.minute());
+	}
+}
+
+void Decoder::end_minute(const MsfDecoder::Minute &minute) {
+	/* The minute that starts after this one is encoded */
+	time_t t = (minute.start_us + ONE_MINUTE_US / 2) / ONE_MINUTE_US * 60 + 60;
+	bool valid = minute.errors == MsfDecoder::NONE && minute.utc_time == (uint64_t)t
+		&& t > last_s_ && check(minute.frame, t);
+
+	if (valid) {
+		result_.ok++;
+		ok_.push_back(t);
+	} else if (!disturbed_.contains(t)) {
+		struct tm tm{};
+
+		result_.invalid++;
+		gmtime_r(&t, &tm);
+		std::printf("Invalid minute before %04d-%02d-%02dT%02d:%02dZ (errors 0x%02x)\n",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+			minute.errors);
+	}
+
+	last_s_ = std::max(last_s_, t);
+}
+
+void Decoder::set_bcd(bits_t &bits, size_t begin, size_t end, unsigned int value) {
+	for (size_t i = end, n = 0; i >= begin; i--, n++) {
+		unsigned int digit = value;
+
+		for (size_t j = 0; j < n / 4; j++) {
+			digit /= 10U;
+		}
+
+		bits[i] = ((digit % 10U) >> (n % 4)) & 1U;
+	}
+}
+
+bool Decoder::odd_parity(const bits_t &bits, size_t begin, size_t end) {
+	size_t count = 0;
+
+	for (size_t i = begin; i <= end; i++) {
+		count += bits[i];
+	}
+
+	return count % 2 == 0;
+}
+
+/* Summer time from 01:00 UTC on the last Sunday in March to October */
+bool Decoder::uk_summer(time_t t) {
+	struct tm tm{};
+
+	gmtime_r(&t, &tm);
+
+	auto last_sunday = [year = tm.tm_year] (int month) {
+		struct tm day{};
+
+		day.tm_year = year;
+		day.tm_mon = month;
+		day.tm_mday = 31;
+		day.tm_hour = 1;
+
+		time_t ts = timegm(&day);
+
+		gmtime_r(&ts, &day);
+		return ts - day.tm_wday * 86400;
+	};
+
+	return t >= last_sunday(2) && t < last_sunday(9);
+}
+
+/* Compare with the frame for t from libc and the UK summer time rules */
+bool Decoder::check(const MsfDecoder::Frame &frame, time_t t) const {
+	bool summer = uk_summer(t);
+	time_t local = t + (summer ? 3600 : 0);
+	struct tm tm{};
+	bits_t a;
+	bits_t b;
+
+	gmtime_r(&local, &tm);
+
+	set_bcd(a, 17, 24, (tm.tm_year + 1900) % 100);
+	set_bcd(a, 25, 29, tm.tm_mon + 1);
+	set_bcd(a, 30, 35, tm.tm_mday);
+	set_bcd(a, 36, 38, tm.tm_wday);
+	set_bcd(a, 39, 44, tm.tm_hour);
+	set_bcd(a, 45, 51, tm.tm_min);
+	for (size_t i = 53; i <= 58; i++) {
+		a[i] = true;
+	}
+
+	b[53] = uk_summer(t + 61 * 60) != summer;
+	b[54] = odd_parity(a, 17, 24);
+	b[55] = odd_parity(a, 25, 35);
+	b[56] = odd_parity(a, 36, 38);
+	b[57] = odd_parity(a, 39, 51);
+	b[58] = summer;
+
+	return a == frame.a && b == frame.b;
+}
+
+void Decoder::disturbed(int64_t ts_us) {
+	time_t t = ts_us / ONE_MINUTE_US * 60 + 60;
+
+	disturbed_.insert(t);
+	disturbed_.insert(t + 60);
+	disturbed_.insert(t + 120);
+}
+
+void Decoder::stopped(int64_t ts_us) {
+	time_t t = ts_us / ONE_MINUTE_US * 60 + 60;
+
+	stopped_.insert(t);
+	stopped_.insert(t + 60);
+	stopped_.insert(t + 120);
+}
+
+/*
+ * Every minute from the first valid minute to the last must be valid unless
+ * the system clock was wrong, and it must have been transmitted unless the
+ * clock was too wrong or there were no NTP offsets
+ */
+Result Decoder::finish() {
+	if (ok_.empty()) {
+		return result_;
+	}
+
+	auto ok = ok_.cbegin();
+
+	result_.last_s = ok_.back();
+
+	for (time_t t = ok_.front(); t <= ok_.back(); t += 60) {
+		if (*ok == t) {
+			ok++;
+		} else if (transmitted_.contains(t) ? disturbed_.contains(t) : stopped_.contains(t)) {
+			result_.disturbed++;
+		} else {
+			struct tm tm{};
+
+			result_.missing++;
+			gmtime_r(&t, &tm);
+			std::printf("Missing minute before %04d-%02d-%02dT%02d:%02dZ\n",
+				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
+		}
+	}
+
+	return result_;
+}
+
+/* Virtual clocks */
+static uint64_t uptime_us;
+static int64_t wall_offset_us;
+static int64_t reference_start_us;
+static double frequency;
+static double temperature;
+static double temperature_period_us;
+static uint64_t holdover_us;
+
+static esp_log_level_t log_level{ESP_LOG_WARN};
+
+/* Repeats of the same message, which are only logged once unless verbose */
+struct LogRepeats {
+	char level;
+	uint64_t count;
+	std::string last;
+};
+
+static std::map<const char*, LogRepeats> log_repeats;
+static std::vector<esp_timer*> timers;
+static std::vector<TaskHandle_t> tasks;
+static std::mutex task_mutex;
+static std::condition_variable task_cv;
+static thread_local TaskHandle_t current_task;
+static std::mt19937_64 rng;
+static Decoder *decoder;
+
+static int64_t reference_us() {
+	double drift_us = uptime_us * frequency;
+
+	if (temperature_period_us) {
+		/* Integral of the sinusoidal change of the frequency error */
+		drift_us += temperature * temperature_period_us / (2.0 * std::numbers::pi)
+			* (1.0 - std::cos(2.0 * std::numbers::pi * uptime_us / temperature_period_us));
+	}
+
+	return reference_start_us + (int64_t)uptime_us - std::llround(drift_us);
+}
+
+static int64_t wall_us() {
+	return wall_offset_us + (int64_t)uptime_us;
+}
+
+/* Error of the system clock */
+static int64_t clock_error_us() {
+	return std::abs(wall_us() - reference_us());
+}
+
+/* NTP offsets are still being received */
+static bool syncing() {
+	return !holdover_us || uptime_us < holdover_us;
+}
+
+static esp_timer *next_timer() {
+	esp_timer *next = nullptr;
+
+	for (auto *timer : timers) {
+		if (timer->armed && (!next || timer->expiry_us < next->expiry_us)) {
+			next = timer;
+		}
+	}
+
+	return next;
+}
+
+static TaskHandle_t next_task() {
+	TaskHandle_t next = nullptr;
+
+	for (auto *task : tasks) {
+		if (!next || task->wake_us < next->wake_us) {
+			next = task;
+		}
+	}
+
+	return next;
+}
+
+/* Run a task until it waits for something */
+static void run_task(TaskHandle_t task) {
+	std::unique_lock lock{task_mutex};
+
+	task->wake_us = UINT64_MAX;
+	task->running = true;
+	task_cv.notify_all();
+	task_cv.wait(lock, [task] { return !task->running; });
+}
+
+/* Return to the simulation from a task until run_task() is called */
+static void yield_task(TaskHandle_t task) {
+	std::unique_lock lock{task_mutex};
+
+	task->running = false;
+	task_cv.notify_all();
+	task_cv.wait(lock, [task] { return task->running; });
+}
+
+static Result simulate(const Scenario &scenario) {
+	const uint64_t end_us = scenario.duration_s * ONE_SECOND_US;
+	std::normal_distribution<double> noise{0.0, scenario.noise_us};
+	uint64_t ntp_us = NTP_FIRST_US;
+	size_t step = 0;
+
+	reference_start_us = scenario.start_s * ONE_SECOND_US;
+	frequency = scenario.frequency_ppm / 1e6;
+	temperature = scenario.temperature_ppm / 1e6;
+	temperature_period_us = scenario.temperature_period_s * ONE_SECOND_US;
+	holdover_us = scenario.holdover_s * ONE_SECOND_US;
+	const uint64_t latency_us = scenario.latency_us;
+
+	decoder = new Decoder{civil::from_days(scenario.start_s / civil::SECONDS_PER_DAY).year};
+
+	auto *network = new Network;
+
+	new Transmit{*network, {MSF_GPIO, GPIO_NUM_NC, GPIO_NUM_NC, GPIO_NUM_NC}, false};
+
+	while (true) {
+		esp_timer *timer = next_timer();
+		TaskHandle_t task = next_task();
+		uint64_t step_us = step < scenario.steps.size()
+			? scenario.steps[step].uptime_s * ONE_SECOND_US : UINT64_MAX;
+		uint64_t timer_us = timer ? timer->expiry_us : UINT64_MAX;
+		uint64_t task_us = task ? task->wake_us : UINT64_MAX;
+		uint64_t next_us = std::min({timer_us, ntp_us, step_us, task_us});
+
+		if (next_us > end_us) {
+			break;
+		}
+
+		uptime_us = std::max(uptime_us, next_us);
+
+		if (next_us == step_us) {
+			wall_offset_us += scenario.steps[step].step_us;
+			step++;
+		} else if (next_us == ntp_us) {
+			if (syncing()) {
+				Network::time_offset(std::llround(reference_us() - wall_us() + noise(rng)));
+			}
+			ntp_us += NTP_INTERVAL_US;
+		} else if (next_us == task_us) {
+			run_task(task);
+		} else {
+			/*
+			 * Uniformly distributed up to twice the mean, and occasionally
+			 * delayed by something else on the same core
+			 */
+			uint64_t random = rng();
+			uint64_t delay_us = (random & 0xFFFF) * latency_us / 0x8000;
+
+			if ((random >> 16) % 10000 == 0) {
+				delay_us += 2000;
+			}
+
+			uptime_us += delay_us;
+			timer->armed = false;
+			timer->callback(timer->arg);
+		}
+
+		const int64_t error_us = clock_error_us();
+
+		if (error_us > DISTURBED_US) {
+			decoder->disturbed(reference_us());
+		}
+
+		if (error_us > HOLDOVER_LIMIT_US || !syncing()) {
+			decoder->stopped(reference_us());
+		}
+	}
+
+	return decoder->finish();
+}
+
+} // namespace
+
+/* Virtual system clock, see Network::wall_us() */
+extern "C" int gettimeofday(struct timeval *tv, void *) noexcept {
+	int64_t now_us = wall_us();
+
+	tv->tv_sec = now_us / ONE_SECOND_US;
+	tv->tv_usec = now_us % ONE_SECOND_US;
+	return 0;
+}
+
+extern "C" int settimeofday(const struct timeval *tv, const struct timezone *) noexcept {
+	wall_offset_us = tv->tv_sec * ONE_SECOND_US + tv->tv_usec - (int64_t)uptime_us;
+	return 0;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+	switch (code) {
+	case ESP_OK:
+		return "ESP_OK";
+
+	case ESP_ERR_NO_MEM:
+		return "ESP_ERR_NO_MEM";
+
+	case ESP_ERR_INVALID_ARG:
+		return "ESP_ERR_INVALID_ARG";
+
+	case ESP_ERR_INVALID_STATE:
+		return "ESP_ERR_INVALID_STATE";
+
+	default:
+		return "ESP_FAIL";
+	}
+}
+
+void esp_error_check_failed(esp_err_t rc, const char *file, int line,
+		const char *function, const char *expression) {
+	std::fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d in %s: %s\n",
+		rc, esp_err_to_name(rc), file, line, function, expression);
+	std::abort();
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+	static constexpr const char LEVELS[] = "NEWIDV";
+	va_list args;
+
+	if (level > log_level) {
+		return;
+	}
+
+	auto &repeats = log_repeats[format];
+
+	if (repeats.count++ && log_level <= ESP_LOG_WARN) {
+		std::array<char, 256> text;
+
+		va_start(args, format);
+		std::vsnprintf(text.data(), text.size(), format, args);
+		va_end(args);
+
+		repeats.level = LEVELS[level];
+		repeats.last = std::string{"("} + std::to_string(uptime_us / 1000U)
+			+ ") " + tag + ": " + text.data();
+		return;
+	}
+
+	std::printf("%c (%" PRIu64 ") %s: ", LEVELS[level], uptime_us / 1000U, tag);
+	va_start(args, format);
+	std::vprintf(format, args);
+	va_end(args);
+	std::printf("\n");
+}
+
+/* Log the last of each repeated message and how many times it was repeated */
+static void log_summary() {
+	for (const auto &[format, repeats] : log_repeats) {
+		if (repeats.count > 1 && !repeats.last.empty()) {
+			std::printf("%c %s (repeated %" PRIu64 " times)\n", repeats.level,
+				repeats.last.c_str(), repeats.count - 1);
+		}
+	}
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args,
+		esp_timer_handle_t *out_handle) {
+	*out_handle = new esp_timer{create_args->callback, create_args->arg, false, 0};
+	timers.push_back(*out_handle);
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+	if (timer->armed) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	timer->armed = true;
+	timer->expiry_us = uptime_us + timeout_us;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+	if (!timer->armed) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	timer->armed = false;
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+	return uptime_us;
+}
+
+esp_err_t gpio_config(const gpio_config_t *) {
+	return ESP_OK;
+}
+
+/* Output changes are decoded at the reference time when they happen */
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+	if (gpio_num == MSF_GPIO) {
+		const int64_t error_us = clock_error_us();
+
+		/*
+		 * Without NTP offsets, the time signal must stop before the system
+		 * clock is too wrong, so those changes are always judged
+		 */
+		decoder->edge(reference_us(), level != 0, error_us > DISTURBED_US
+			&& (syncing() || error_us <= HOLDOVER_LIMIT_US));
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t gpio_sleep_sel_dis(gpio_num_t) {
+	return ESP_OK;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *,
+		uint32_t, void *arg, UBaseType_t, TaskHandle_t *handle, BaseType_t) {
+	TaskHandle_t task = new tskTaskControlBlock{function, arg, uptime_us, 0, false};
+
+	tasks.push_back(task);
+
+	std::thread{[task] {
+		current_task = task;
+		yield_task(task);
+		task->function(task->arg);
+	}}.detach();
+
+	/* Wait for the thread to start */
+	std::unique_lock lock{task_mutex};
+
+	task->running = true;
+	task_cv.wait(lock, [task] { return !task->running; });
+
+	if (handle) {
+		*handle = task;
+	}
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+	TaskHandle_t task = current_task;
+
+	if (!task->notifications && ticks) {
+		task->wake_us = ticks == portMAX_DELAY ? UINT64_MAX
+			: uptime_us + (uint64_t)ticks * portTICK_PERIOD_MS * 1000U;
+		yield_task(task);
+	}
+
+	uint32_t value = task->notifications;
+
+	task->notifications = clear ? 0 : value - (value ? 1 : 0);
+	return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	task->notifications++;
+	task->wake_us = std::min(task->wake_us, uptime_us + TASK_LATENCY_US);
+	return pdPASS;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer) {
+	return reinterpret_cast<EventGroupHandle_t>(buffer);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+	auto *buffer = reinterpret_cast<StaticEventGroup_t*>(group);
+
+	return buffer->bits |= bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+		BaseType_t clear_on_exit, BaseType_t, TickType_t) {
+	auto *buffer = reinterpret_cast<StaticEventGroup_t*>(group);
+	EventBits_t value = buffer->bits;
+
+	if (clear_on_exit) {
+		buffer->bits &= ~bits;
+	}
+
+	return value;
+}
+
+/* Only the time keeping of Network is simulated */
+Network::Network() {}
+
+int main(int argc, char *argv[]) {
+	const char *filter{nullptr};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		if (opt == 'v') {
+			log_level = static_cast<esp_log_level_t>(log_level + 1);
+		} else {
+			std::fprintf(stderr, "Usage: %s [-v] [filter]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind + 1 < argc) {
+		std::fprintf(stderr, "Usage: %s [-v] [filter]\n", argv[0]);
+		return EXIT_FAILURE;
+	} else if (optind < argc) {
+		filter = argv[optind];
+	}
+
+	static const Scenario scenarios[] = {
+		{ "2024-06 to 2025-06 (summer time, new year)", 1717200000, 366 * 86400, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "Summer time ends 2024-10-27, clock steps", 1729980000, 12 * 3600, -25.0, 0.0, 0.0, 2000.0, 30, 0, {
+			{ 1 * 3600 + 7, 5000000 },
+			{ 3 * 3600 + 31, -5000000 },
+			{ 5 * 3600 + 43, -30000000 },
+			{ 7 * 3600 + 12, 400000 },
+			{ 9 * 3600 + 55, -400000 },
+		} },
+		{ "Summer time starts 2025-03-30", 1743292800, 6 * 3600, 40.0, 0.0, 0.0, 500.0, 30, 0, {} },
+		{ "1999-12-31 23:53:50", 946684430, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2000-01-01 00:00:00", 946684800, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2038-01-19 03:07:50", 2147483270, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2082-07-18 12:00:00", 3551598000, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2099-12-31 23:53:50", 4102444430, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2100-02-27 to 2100-03-02 (not a leap year)", 4107369600, 3 * 86400, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "2106-02-07 06:21:50", 4294966910, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "3000-01-01 00:00:00", 32503680000, 3600, 15.0, 0.0, 0.0, 2000.0, 30, 0, {} },
+		{ "Holdover from 2025-01-01 04:00, drift", 1735689600, 16 * 3600, -20.0, 3.0, 6.0 * 3600.0, 1000.0, 30, 4 * 3600, {} },
+	};
+	bool ok = true;
+
+	std::printf("%-44s %8s %8s %8s %8s %9s %8s %8s\n", "scenario", "minutes",
+		"invalid", "disturb", "missing", "late", "max (us)", "time (s)");
+
+	/*
+	 * Each scenario runs in its own process because Transmit and the
+	 * Network time keeping can't be reset
+	 */
+	for (const auto &scenario : scenarios) {
+		if (filter && !std::strstr(scenario.name, filter)) {
+			continue;
+		}
+
+		std::fflush(stdout);
+
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			auto start = steady_clock::now();
+			Result result = simulate(scenario);
+			auto elapsed = duration<double>(steady_clock::now() - start);
+
+			log_summary();
+
+			if (scenario.holdover_s) {
+				std::printf("Holdover: valid minutes for %.1fh after the last NTP offset\n",
+					(result.last_s - scenario.start_s - (int64_t)scenario.holdover_s) / 3600.0);
+			}
+
+			std::printf("%-44s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+				" %9" PRIu64 " %8" PRId64 " %8.2f\n", scenario.name, result.ok,
+				result.invalid, result.disturbed, result.missing,
+				result.late_changes, result.max_error_us, elapsed.count());
+			std::fflush(stdout);
+			_exit(result.ok && !result.invalid && !result.missing
+				&& !result.late_changes ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		int status = 0;
+
+		if (pid < 0 || waitpid(pid, &status, 0) != pid
+				|| !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			ok = false;
+		}
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
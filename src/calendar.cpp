@@ -18,97 +18,132 @@
 
 #include "clockson/calendar.h"
 
-#include <assert.h>
-
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <ctime>
-#include <string>
-#include <vector>
+
+#include "clockson/civil.h"
 
 namespace clockson {
 
-Calendar::Calendar(time_t t) : Calendar(t, false) {
-	summer_change_soon_ = Calendar{t, true}.summer() != summer_;
+template <class Zone>
+BasicCalendar<Zone>::BasicCalendar(time_t t) {
+	uint64_t ts = t;
+
+	ts /= civil::SECONDS_PER_MINUTE; /* current minute */
+	ts *= civil::SECONDS_PER_MINUTE;
+
+	utc_time_ = ts;
+
+	set_summer(civil::from_days(ts / civil::SECONDS_PER_DAY).year);
+
+	ts += Zone::OFFSET_S;
+
+	if (summer_) {
+		ts += civil::SECONDS_PER_HOUR;
+	}
+
+	const uint64_t days = ts / civil::SECONDS_PER_DAY;
+	const uint64_t seconds = ts % civil::SECONDS_PER_DAY;
+	const civil::Date date = civil::from_days(days);
+
+	year_ = date.year;
+	month_ = date.month;
+	day_ = date.day;
+	weekday_ = civil::weekday(days);
+	hour_ = seconds / civil::SECONDS_PER_HOUR;
+	minute_ = seconds % civil::SECONDS_PER_HOUR / civil::SECONDS_PER_MINUTE;
 }
 
-Calendar::Calendar(std::chrono::system_clock::time_point tp)
-		: Calendar(std::chrono::system_clock::to_time_t(tp)) {
+template <class Zone>
+BasicCalendar<Zone>::BasicCalendar(std::chrono::system_clock::time_point tp)
+		: BasicCalendar(std::chrono::system_clock::to_time_t(tp)) {
 }
 
-Calendar::Calendar(time_t t, bool next) {
-	struct tm tm{};
-	uint64_t ts = t;
+template <class Zone>
+BasicCalendar<Zone> BasicCalendar<Zone>::next() const {
+	BasicCalendar next{*this};
+
+	next.utc_time_ += civil::SECONDS_PER_MINUTE;
+
+	/*
+	 * The local year is only different from the UTC year close to the end
+	 * of the year, when summer time is never in effect or about to change.
+	 */
+	next.set_summer(year_);
 
-	ts /= 60U; /* current minute */
-	if (next) {
-		ts += 61U; /* 61 minutes in the future */
+	if (++next.minute_ == 60) {
+		next.minute_ = 0;
+		next.hour_++;
 	}
-	ts *= 60U;
-	t = ts;
-
-	assert(gmtime_r(&t, &tm) == &tm);
-
-	switch (tm.tm_mon + 1) {
-	case 1: /* January */
-	case 2: /* February */
-	case 11: /* November */
-	case 12: /* December */
-		summer_ = false;
-		break;
-
-	case 4: /* April */
-	case 5: /* May */
-	case 6: /* June */
-	case 7: /* July */
-	case 8: /* August */
-	case 9: /* September */
-		summer_ = true;
-		break;
-
-	default: /* March/October */
-		int last_sunday = tm.tm_mday + (tm.tm_wday ? (7 - tm.tm_wday) : 0);
-
-		while (last_sunday <= 31) {
-			last_sunday += 7;
-		}
-		last_sunday -= 7;
 
-		summer_ = (
-				(tm.tm_mday == last_sunday && tm.tm_hour >= 1)
-					|| tm.tm_mday > last_sunday
-			) ^ ((tm.tm_mon + 1) == 10 /* October */);
-		break;
+	if (next.summer_ != summer_) {
+		/*
+		 * Summer time changes at 01:00 UTC, which is never midnight in
+		 * the local time, so this never changes the day
+		 */
+		if (next.summer_) {
+			next.hour_++;
+		} else {
+			next.hour_--;
+		}
 	}
 
-	utc_time_ = t;
+	if (next.hour_ == 24) {
+		next.hour_ = 0;
+		next.weekday_ = (next.weekday_ + 1) % 7;
 
-	if (summer_) {
-		ts += 3600U;
-		t = ts;
+		if (++next.day_ > civil::days_in_month(next.year_, next.month_)) {
+			next.day_ = 1;
 
-		assert(gmtime_r(&t, &tm) == &tm);
+			if (++next.month_ > 12) {
+				next.month_ = 1;
+				next.year_++;
+			}
+		}
+	}
+
+	return next;
+}
+
+template <class Zone>
+void BasicCalendar<Zone>::set_summer(unsigned int utc_year) {
+	if constexpr (!Zone::SUMMER_TIME) {
+		return;
 	}
 
-	year_ = tm.tm_year + 1900;
-	month_ = tm.tm_mon + 1;
-	day_ = tm.tm_mday;
-	weekday_ = tm.tm_wday;
-	hour_ = tm.tm_hour;
-	minute_ = tm.tm_min;
+	/*
+	 * Summer time starts and ends in the same UTC year, so the year of the
+	 * current UTC time can be used to check both now and at the end of the
+	 * warning period.
+	 */
+	const uint64_t begin = civil::summer_begin(utc_year);
+	const uint64_t end = civil::summer_end(utc_year);
+	const uint64_t next = utc_time_ + Zone::SUMMER_WARNING_S;
+
+	summer_ = utc_time_ >= begin && utc_time_ < end;
+	summer_change_soon_ = (next >= begin && next < end) != summer_;
 }
 
-std::string Calendar::to_string() const {
-	std::vector<char> text(32);
+template <class Zone>
+typename BasicCalendar<Zone>::String BasicCalendar<Zone>::to_string() const {
+	String text;
 
 	std::snprintf(text.data(), text.size(),
-		"%04u-%02u-%02uT%02u:%02u+0%u:00%s",
+		"%04u-%02u-%02uT%02u:%02u+%02u:00%s",
 		year_, month_, day_, hour_, minute_,
-		summer_ ? 1U : 0U,
+		(unsigned int)((Zone::OFFSET_S + (summer_ ? civil::SECONDS_PER_HOUR : 0))
+			/ civil::SECONDS_PER_HOUR),
 		summer_change_soon_ ? "#" : "");
 
-	return {text.data(), text.size()};
+	return text;
 }
 
+template class BasicCalendar<zone::UK>;
+template class BasicCalendar<zone::CET>;
+template class BasicCalendar<zone::UTC>;
+template class BasicCalendar<zone::JST>;
+
 } // namespace clockson
@@ -18,34 +18,81 @@
 
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <ctime>
-#include <string>
+
+#include "civil.h"
 
 namespace clockson {
 
-class Calendar {
+/* Local time of each time signal */
+namespace zone {
+
+/* UK time (GMT/BST) */
+struct UK {
+	/* Offset of standard time from UTC */
+	static constexpr uint64_t OFFSET_S = 0;
+	/* Summer time is observed using the European rules */
+	static constexpr bool SUMMER_TIME = true;
+	/* Time before a summer time change that it's announced (MSF B53) */
+	static constexpr uint64_t SUMMER_WARNING_S = 61 * 60;
+};
+
+/* Central European Time (CET/CEST) */
+struct CET {
+	static constexpr uint64_t OFFSET_S = 3600;
+	static constexpr bool SUMMER_TIME = true;
+	/* DCF77 A1 */
+	static constexpr uint64_t SUMMER_WARNING_S = 60 * 60;
+};
+
+/* Coordinated Universal Time */
+struct UTC {
+	static constexpr uint64_t OFFSET_S = 0;
+	static constexpr bool SUMMER_TIME = false;
+	static constexpr uint64_t SUMMER_WARNING_S = 0;
+};
+
+/* Japan Standard Time */
+struct JST {
+	static constexpr uint64_t OFFSET_S = 9 * 3600;
+	static constexpr bool SUMMER_TIME = false;
+	static constexpr uint64_t SUMMER_WARNING_S = 0;
+};
+
+} // namespace zone
+
+template <class Zone>
+class BasicCalendar {
 public:
-	explicit Calendar(time_t t);
-	explicit Calendar(std::chrono::system_clock::time_point tp);
-	~Calendar() = default;
+	explicit BasicCalendar(time_t t);
+	explicit BasicCalendar(std::chrono::system_clock::time_point tp);
+	~BasicCalendar() = default;
 
 	inline uint64_t utc_time() const { return utc_time_; }
 	inline uint16_t year() const { return year_; }
 	inline uint8_t month() const { return month_; }
 	inline uint8_t day() const { return day_; }
+	inline uint16_t day_of_year() const { return civil::day_of_year(year_, month_, day_); }
 	inline uint8_t weekday() const { return weekday_; } /* 0 = Sunday */
 	inline uint8_t hour() const { return hour_; }
 	inline uint8_t minute() const { return minute_; }
 	inline bool summer() const { return summer_; }
 	inline bool summer_change_soon() const { return summer_change_soon_; }
 
-	std::string to_string() const;
+	/* Calendar for the following minute, derived from the current fields */
+	BasicCalendar next() const;
+
+	/* Local time in ISO 8601 format, with "#" if summer time changes soon */
+	using String = std::array<char, 32>;
+
+	String to_string() const;
 
 private:
-	Calendar(time_t t, bool next);
+	void set_summer(unsigned int utc_year);
 
 	uint64_t utc_time_{0};
 	uint16_t year_{0};
@@ -58,4 +105,11 @@ private:
 	bool summer_change_soon_{false};
 };
 
+extern template class BasicCalendar<zone::UK>;
+extern template class BasicCalendar<zone::CET>;
+extern template class BasicCalendar<zone::UTC>;
+extern template class BasicCalendar<zone::JST>;
+
+using Calendar = BasicCalendar<zone::UK>;
+
 } // namespace clockson
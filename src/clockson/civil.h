@@ -0,0 +1,143 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Conversions between days since the 1970 Unix epoch and the proleptic
+ * Gregorian calendar, based on the days_from_civil/civil_from_days
+ * algorithms by Howard Hinnant. Only times from the epoch onwards are
+ * supported so everything is unsigned.
+ */
+namespace civil {
+
+static constexpr uint64_t SECONDS_PER_MINUTE = 60;
+static constexpr uint64_t SECONDS_PER_HOUR = 60 * SECONDS_PER_MINUTE;
+static constexpr uint64_t SECONDS_PER_DAY = 24 * SECONDS_PER_HOUR;
+
+/* Days from 0000-03-01 to 1970-01-01 */
+static constexpr uint64_t EPOCH_DAYS = 719468;
+static constexpr uint64_t DAYS_PER_ERA = 146097; /* 400 years */
+
+struct Date {
+	uint16_t year;
+	uint8_t month; /* 1 = January */
+	uint8_t day;
+};
+
+constexpr Date from_days(uint64_t days) {
+	const uint64_t z = days + EPOCH_DAYS;
+	const uint64_t era = z / DAYS_PER_ERA;
+	const uint64_t doe = z - era * DAYS_PER_ERA; /* [0, 146096] */
+	const uint64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; /* [0, 399] */
+	const uint64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100); /* [0, 365] from March */
+	const uint64_t mp = (5 * doy + 2) / 153; /* [0, 11] from March */
+	const uint64_t day = doy - (153 * mp + 2) / 5 + 1; /* [1, 31] */
+	const uint64_t month = mp < 10 ? mp + 3 : mp - 9; /* [1, 12] */
+
+	return {
+		static_cast<uint16_t>(yoe + era * 400 + (month <= 2)),
+		static_cast<uint8_t>(month),
+		static_cast<uint8_t>(day),
+	};
+}
+
+constexpr uint64_t to_days(unsigned int year, unsigned int month, unsigned int day) {
+	const uint64_t y = year - (month <= 2);
+	const uint64_t era = y / 400;
+	const uint64_t yoe = y - era * 400; /* [0, 399] */
+	const uint64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; /* [0, 365] */
+	const uint64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy; /* [0, 146096] */
+
+	return era * DAYS_PER_ERA + doe - EPOCH_DAYS;
+}
+
+constexpr bool leap_year(unsigned int year) {
+	return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+constexpr uint8_t days_in_month(unsigned int year, unsigned int month) {
+	if (month == 2) {
+		return leap_year(year) ? 29 : 28;
+	}
+
+	/* 31 days in odd months until July, then in even months */
+	return 30 + ((month + (month >> 3)) & 1);
+}
+
+/* 1 = 1st of January */
+constexpr uint16_t day_of_year(unsigned int year, unsigned int month, unsigned int day) {
+	return to_days(year, month, day) - to_days(year, 1, 1) + 1;
+}
+
+/* 0 = Sunday */
+constexpr uint8_t weekday(uint64_t days) {
+	/* 1970-01-01 was a Thursday */
+	return (days + 4) % 7;
+}
+
+/* First Sunday on or after a day */
+constexpr uint64_t sunday_from(uint64_t days) {
+	return days + (7 - weekday(days)) % 7;
+}
+
+/* Last Sunday of a month that has 31 days */
+constexpr uint64_t last_sunday(unsigned int year, unsigned int month) {
+	const uint64_t last_day = to_days(year, month, 31);
+
+	return last_day - weekday(last_day);
+}
+
+/*
+ * UK summer time starts at 01:00 UTC on the last Sunday in March and ends at
+ * 01:00 UTC on the last Sunday in October.
+ */
+constexpr uint64_t summer_begin(unsigned int year) {
+	return last_sunday(year, 3) * SECONDS_PER_DAY + SECONDS_PER_HOUR;
+}
+
+constexpr uint64_t summer_end(unsigned int year) {
+	return last_sunday(year, 10) * SECONDS_PER_DAY + SECONDS_PER_HOUR;
+}
+
+static_assert(to_days(1970, 1, 1) == 0);
+static_assert(to_days(2000, 3, 1) == 11017);
+static_assert(from_days(11016).year == 2000);
+static_assert(from_days(11016).month == 2);
+static_assert(from_days(11016).day == 29);
+static_assert(weekday(to_days(2000, 1, 1)) == 6);
+static_assert(day_of_year(2024, 1, 1) == 1);
+static_assert(day_of_year(2024, 12, 31) == 366);
+static_assert(sunday_from(to_days(2024, 3, 8)) == to_days(2024, 3, 10));
+static_assert(sunday_from(to_days(2024, 3, 10)) == to_days(2024, 3, 10));
+static_assert(days_in_month(1900, 2) == 28);
+static_assert(days_in_month(2000, 2) == 29);
+static_assert(days_in_month(2024, 7) == 31);
+static_assert(days_in_month(2024, 8) == 31);
+static_assert(days_in_month(2024, 9) == 30);
+static_assert(summer_begin(2024) == 1711846800); /* 2024-03-31 01:00:00 */
+static_assert(summer_end(2024) == 1729990800); /* 2024-10-27 01:00:00 */
+
+} // namespace civil
+
+} // namespace clockson
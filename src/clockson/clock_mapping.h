@@ -0,0 +1,125 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Mapping from wall clock time to uptime, as a pair of times read from both
+ * clocks and the rate of uptime relative to the wall clock. The rate is kept
+ * as an integer fraction so that it can be applied from an interrupt
+ * handler without using the FPU.
+ */
+class ClockMapping {
+public:
+	/* Rates are in units of 2^-RATE_SHIFT */
+	static constexpr unsigned int RATE_SHIFT = 32;
+	static constexpr double RATE_ONE = (double)(1ULL << RATE_SHIFT);
+
+	/* Number of attempts to read both clocks at the same time */
+	static constexpr unsigned int CORRELATE_ATTEMPTS = 8;
+
+	constexpr ClockMapping() = default;
+
+	/* Fixed offset between the wall clock and uptime */
+	constexpr explicit ClockMapping(uint64_t offset_us)
+		: wall_us_(offset_us) {}
+
+	/*
+	 * Wall clock time wall_us read at uptime_us, with uptime advancing
+	 * by (1 + rate * 2^-RATE_SHIFT) for every microsecond of wall clock time
+	 */
+	constexpr ClockMapping(uint64_t wall_us, uint64_t uptime_us, int64_t rate,
+			uint32_t window_us = 0)
+		: wall_us_(wall_us), uptime_us_(uptime_us), rate_(rate),
+		window_us_(window_us) {}
+
+	~ClockMapping() = default;
+
+	/*
+	 * Read the wall clock between two reads of uptime, repeatedly, and use
+	 * the pair of reads that are closest together so that an interrupt or
+	 * context switch between them doesn't skew the mapping. The wall clock
+	 * time is assumed to be read half way between the uptime reads.
+	 */
+	template <class Uptime, class Wall>
+	static ClockMapping correlate(Uptime &&uptime, Wall &&wall, int64_t rate) {
+		ClockMapping best;
+		uint64_t best_window_us = UINT64_MAX;
+
+		for (unsigned int i = 0; i < CORRELATE_ATTEMPTS; i++) {
+			const uint64_t before_us = uptime();
+			const uint64_t wall_us = wall();
+			const uint64_t after_us = uptime();
+			const uint64_t window_us = after_us - before_us;
+
+			if (window_us < best_window_us) {
+				best = {wall_us, before_us + window_us / 2, rate, (uint32_t)window_us};
+				best_window_us = window_us;
+			}
+		}
+
+		return best;
+	}
+
+	/* Rate of uptime relative to a clock with a frequency error */
+	static constexpr int64_t rate_from_frequency(double frequency) {
+		return (int64_t)(-frequency / (1.0 + frequency) * RATE_ONE);
+	}
+
+	/* Uptime that elapses while the wall clock advances by wall_us */
+	constexpr int64_t elapsed(int64_t wall_us) const {
+		return wall_us + ((wall_us * rate_) >> RATE_SHIFT);
+	}
+
+	/* Uptime when the wall clock is at wall_us */
+	constexpr int64_t uptime(int64_t wall_us) const {
+		return (int64_t)uptime_us_ + elapsed(wall_us - (int64_t)wall_us_);
+	}
+
+	/* Wall clock time at the reference point */
+	inline uint64_t wall_us() const { return wall_us_; }
+	/* Uptime at the reference point */
+	inline uint64_t uptime_us() const { return uptime_us_; }
+	inline int64_t offset_us() const { return wall_us_ - uptime_us_; }
+	inline int64_t rate() const { return rate_; }
+	inline double rate_ppm() const { return rate_ / RATE_ONE * 1e6; }
+	/* Time between the uptime reads that the wall clock was read between */
+	inline uint32_t window_us() const { return window_us_; }
+
+	/* The same mapping with the wall clock moved forward by offset_us */
+	constexpr ClockMapping shift(int64_t offset_us) const {
+		return {wall_us_ + offset_us, uptime_us_, rate_, window_us_};
+	}
+
+private:
+	uint64_t wall_us_{0};
+	uint64_t uptime_us_{0};
+	int64_t rate_{0};
+	uint32_t window_us_{0};
+};
+
+static_assert(ClockMapping{1000000}.uptime(61000000) == 60000000);
+static_assert(ClockMapping{1000000, 0, -(1LL << 32) / 1000000}.uptime(61000000) == 59999940);
+static_assert(ClockMapping::rate_from_frequency(0.0) == 0);
+
+} // namespace clockson
@@ -0,0 +1,154 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Software clock discipline for the system clock, which is derived from the
+ * crystal and only corrected by steps. Successive offset measurements (from
+ * SNTP) are filtered to estimate both the phase and the frequency error of
+ * the uncorrected clock, so that the system clock can be corrected for the
+ * frequency error continuously instead of drifting back between polls.
+ *
+ * The estimator is an alpha-beta filter that starts with the gains of a
+ * least squares fit of all the samples (for fast convergence) and then
+ * settles at minimum gains (for noise rejection). Samples that are much
+ * further from the prediction than usual are ignored unless they persist.
+ *
+ * The drift of the frequency error (e.g. from temperature changes) is also
+ * measured, so that the error of the clock can be bounded while there are no
+ * samples (holdover).
+ */
+class ClockDiscipline {
+public:
+	/* Coefficients of the error bound for the time since the last sample */
+	struct Bound {
+		/* Time of the last sample */
+		uint64_t uptime_us;
+		double phase_us;
+		double frequency;
+		double drift;
+
+		/* Estimated maximum error at now_us */
+		double error_us(uint64_t now_us) const;
+
+		/* Uptime when the estimated maximum error will exceed limit_us */
+		uint64_t limit_uptime_us(double limit_us) const;
+	};
+
+	ClockDiscipline() = default;
+	~ClockDiscipline() = default;
+
+	/*
+	 * Record a measurement of the offset of the system clock (reference time
+	 * minus system time) at uptime_us. Returns false if it was ignored.
+	 */
+	bool sample(uint64_t uptime_us, int64_t offset_us);
+
+	/*
+	 * The system clock has been stepped to the reference time at uptime_us,
+	 * so the phase error is now zero. The frequency, drift and variance
+	 * estimates are kept.
+	 */
+	void step(uint64_t uptime_us);
+
+	/*
+	 * Adjustment to apply to the system clock at uptime_us to correct the
+	 * estimated error, limited to +/-limit_us. The caller must apply it.
+	 */
+	int64_t adjustment(uint64_t uptime_us, int64_t limit_us);
+
+	inline bool valid() const { return samples_ > 0; }
+	inline unsigned int samples() const { return samples_; }
+	inline double frequency_ppm() const { return frequency_ * 1e6; }
+
+	/* Difference between the last sample and its predicted value */
+	inline double residual_us() const { return residual_us_; }
+
+	/*
+	 * Change of phase that was accepted from the last sample because the
+	 * outliers persisted, or 0
+	 */
+	inline double phase_jump_us() const { return phase_jump_us_; }
+
+	/* Largest recent rate of change of the frequency error */
+	inline double drift_ppm_per_hour() const { return drift_max_ * 1e6 * HOUR_US; }
+
+	/*
+	 * Estimated maximum error of the system clock at uptime_us without any
+	 * more samples, from the uncertainty of the phase and frequency
+	 * estimates and the drift of the frequency error
+	 */
+	double error_bound_us(uint64_t uptime_us) const;
+
+	/* Error bound, which only changes with each sample or step */
+	Bound bound() const;
+
+	/* Uptime when the estimated maximum error will exceed limit_us */
+	uint64_t error_limit_uptime_us(double limit_us) const;
+
+private:
+	/* Minimum gains, for a time constant of ~10 polls */
+	static constexpr double ALPHA_MIN = 0.1;
+	static constexpr double BETA_MIN = ALPHA_MIN * ALPHA_MIN / (2.0 - ALPHA_MIN);
+	/* Samples that are needed before outliers are ignored */
+	static constexpr unsigned int MIN_SAMPLES_FOR_OUTLIERS = 4;
+	static constexpr double MIN_OUTLIER_US = 2000.0;
+	static constexpr double OUTLIER_DEVIATIONS = 4.0;
+	/* Consecutive outliers that are ignored before they're accepted */
+	static constexpr unsigned int MAX_OUTLIERS = 3;
+	static constexpr double HOUR_US = 3600e6;
+	/* Standard deviations of the phase and frequency in the error bound */
+	static constexpr double BOUND_DEVIATIONS = 3.0;
+	/* Frequency error before it has been measured (crystal tolerance) */
+	static constexpr double FREQUENCY_TOLERANCE = 50e-6;
+	/* Time constant for measuring the drift of the frequency error */
+	static constexpr double DRIFT_TIME_CONSTANT_US = HOUR_US;
+	/* Time for the largest recent drift to decay, to include daily changes */
+	static constexpr double DRIFT_DECAY_US = 24 * HOUR_US;
+	/* Drift that is always assumed (ageing and changes that are too fast) */
+	static constexpr double DRIFT_MIN = 0.1e-6 / HOUR_US;
+
+	/* Estimated error of the uncorrected clock at last_uptime_us_ */
+	double phase_us_{0};
+	/* Estimated frequency error of the uncorrected clock */
+	double frequency_{0};
+	/* Exponential average of the squared residuals */
+	double variance_us2_{MIN_OUTLIER_US * MIN_OUTLIER_US};
+	double residual_us_{0};
+	double phase_jump_us_{0};
+	/* Exponential average of the frequency error, which lags behind it */
+	double frequency_average_{0};
+	/* Estimated rate of change of the frequency error */
+	double drift_{0};
+	/* Largest recent value of drift_, decaying slowly */
+	double drift_max_{0};
+	double interval_us_{0};
+	uint64_t last_uptime_us_{0};
+	/* Adjustments applied to the system clock since the last step */
+	int64_t applied_us_{0};
+	unsigned int samples_{0};
+	unsigned int outliers_{0};
+};
+
+} // namespace clockson
@@ -0,0 +1,102 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "time_signal.h"
+
+namespace clockson {
+
+/*
+ * Output levels for the remainder of a time signal, encoded as RMT symbols
+ * (pairs of durations and levels) so that the timing of every change is
+ * handled by the RMT peripheral.
+ */
+class Envelope {
+public:
+	/* Same layout as rmt_symbol_word_t */
+	using symbol_t = uint32_t;
+
+	static constexpr uint32_t RESOLUTION_HZ = 1000000;
+	static constexpr uint32_t MAX_DURATION = 0x7FFF;
+
+	/*
+	 * Each second has at most 4 changes, and needs at most 34 durations
+	 * when they are split to fit in 15 bits. Allow for up to one more second
+	 * before the first change.
+	 */
+	static constexpr size_t MAX_SYMBOLS = (61 * 34 + 1) / 2;
+
+	Envelope() = default;
+	~Envelope() = default;
+
+	/*
+	 * Encode all of the remaining changes in a time signal, starting at
+	 * start_us with the output at the active (carrier on) level. Returns
+	 * false if there is nothing to transmit.
+	 */
+	bool encode(TimeSignal &signal, uint64_t start_us, int active, int inactive);
+
+	/* Start encoding changes from start_us with the output at level */
+	void begin(uint64_t start_us, int level);
+
+	/*
+	 * Add a change of the output level, which must not be before the
+	 * previous change. Returns false if there are too many symbols.
+	 */
+	bool change(uint64_t ts_us, int level);
+
+	/* Finish encoding, returns false if there is nothing to transmit */
+	bool finish();
+
+	/*
+	 * The transmission is starting late_us after the start time, so shorten
+	 * the first duration to keep every change at the same time. Returns
+	 * false if the first duration is too short to do that completely.
+	 */
+	bool shift_start(uint64_t late_us);
+
+	inline const symbol_t* data() const { return symbols_.data(); }
+	inline size_t size() const { return size_; }
+	inline size_t bytes() const { return size_ * sizeof(symbol_t); }
+
+	/* Time and level of the last change */
+	inline uint64_t end_us() const { return end_us_; }
+	inline int end_level() const { return end_level_; }
+
+	static constexpr symbol_t symbol(uint32_t duration0, int level0,
+			uint32_t duration1, int level1) {
+		return (duration0 & MAX_DURATION) | ((level0 & 1U) << 15)
+			| ((duration1 & MAX_DURATION) << 16) | ((level1 & 1U) << 31);
+	}
+
+private:
+	bool add(uint64_t duration, int level);
+
+	std::array<symbol_t, MAX_SYMBOLS> symbols_;
+	size_t size_{0};
+	bool half_{false};
+	uint64_t end_us_{0};
+	int end_level_{0};
+};
+
+} // namespace clockson
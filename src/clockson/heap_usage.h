@@ -0,0 +1,95 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "freertos.h"
+#include <freertos/task.h>
+
+#include <sdkconfig.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Heap usage, with the number of allocations and frees made by each task if
+ * CONFIG_CLOCKSON_HEAP_TRACE is enabled. After boot, the only tasks that
+ * should be allocating memory are the ones that belong to the network stack.
+ */
+class HeapUsage {
+public:
+	static constexpr size_t MAX_TASKS = 24;
+	static constexpr size_t MAX_LENGTH = 128;
+
+	HeapUsage() = delete;
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+	/* Called from the heap hooks */
+	static void allocated();
+	static void freed();
+#endif
+
+	/*
+	 * Report the current heap usage and the allocations since the last
+	 * report, calling func(text) for each line
+	 */
+	template <class F>
+	static void report(F &&func) {
+		std::array<char, MAX_LENGTH> text;
+
+		summary(text.data(), text.size());
+		func(text.data());
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+		for (size_t i = 0; i < MAX_TASKS; i++) {
+			if (task(i, text.data(), text.size())) {
+				func(text.data());
+			}
+		}
+#endif
+	}
+
+private:
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+	struct Task {
+		std::atomic<TaskHandle_t> handle{nullptr};
+		std::array<char, configMAX_TASK_NAME_LEN> name{};
+		std::atomic<uint32_t> allocs{0};
+		std::atomic<uint32_t> frees{0};
+		uint32_t reported_allocs{0};
+		uint32_t reported_frees{0};
+	};
+
+	static Task* current();
+	static bool task(size_t index, char *text, size_t size);
+#endif
+	static void summary(char *text, size_t size);
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+	static std::array<Task, MAX_TASKS> tasks_;
+	/* Allocations before the scheduler started or when there's no space */
+	static Task other_;
+	static uint32_t reported_allocs_;
+#endif
+};
+
+} // namespace clockson
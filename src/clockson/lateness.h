@@ -0,0 +1,88 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Histogram of how late each output change happens compared to when it was
+ * scheduled. Values below 16us have their own bucket, after that each power
+ * of 2 is split into 8 buckets (so the reported percentiles are within 12.5%
+ * of the actual value) up to ~1s.
+ *
+ * Recording is lock-free so that it can be used from the transmit path
+ * while the summary is read from elsewhere. The summary from the last reset
+ * and the total number of values can also be read at any time (e.g. for
+ * metrics) without affecting the histogram.
+ */
+class LatenessHistogram {
+public:
+	struct Summary {
+		uint32_t count;
+		uint32_t min_us;
+		uint32_t p50_us;
+		uint32_t p99_us;
+		uint32_t p999_us;
+		uint32_t max_us;
+	};
+
+	LatenessHistogram() = default;
+	~LatenessHistogram() = default;
+
+	inline void record(uint64_t scheduled_us, uint64_t actual_us) {
+		record(actual_us > scheduled_us ? actual_us - scheduled_us : 0);
+	}
+
+	void record(uint64_t lateness_us);
+
+	/* Summarise the values recorded so far and reset the histogram */
+	Summary reset();
+
+	/* Summary returned by the last reset */
+	Summary last() const;
+
+	/* Number of values recorded since the histogram was created */
+	inline uint32_t total() const { return total_; }
+
+private:
+	static constexpr unsigned int LINEAR_BITS = 4;
+	static constexpr unsigned int SUB_BUCKET_BITS = 3;
+	static constexpr unsigned int MAX_BITS = 20;
+	static constexpr size_t BUCKETS = (1U << LINEAR_BITS)
+		+ (MAX_BITS - LINEAR_BITS + 1) * (1U << SUB_BUCKET_BITS);
+
+	static size_t bucket(uint32_t value);
+	static uint32_t upper_bound(size_t bucket);
+
+	void save(const Summary &summary);
+
+	std::array<std::atomic<uint32_t>, BUCKETS> buckets_{};
+	std::atomic<uint32_t> min_us_{UINT32_MAX};
+	std::atomic<uint32_t> max_us_{0};
+	std::atomic<uint32_t> total_{0};
+	/* Each field of the last summary, which are all uint32_t */
+	std::array<std::atomic<uint32_t>, sizeof(Summary) / sizeof(uint32_t)> last_{};
+};
+
+} // namespace clockson
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cstddef>
+#include <driver/gpio.h>
 #include <sdkconfig.h>
 
 namespace clockson {
@@ -30,4 +31,9 @@ static constexpr const char *TAG = "clockson";
 #endif
 static constexpr const bool ACTIVE_LOW = CONFIG_CLOCKSON_OUTPUT_ACTIVE_LOW;
 
+static constexpr const gpio_num_t MSF_GPIO = static_cast<gpio_num_t>(CONFIG_CLOCKSON_MSF_GPIO);
+static constexpr const gpio_num_t DCF77_GPIO = static_cast<gpio_num_t>(CONFIG_CLOCKSON_DCF77_GPIO);
+static constexpr const gpio_num_t WWVB_GPIO = static_cast<gpio_num_t>(CONFIG_CLOCKSON_WWVB_GPIO);
+static constexpr const gpio_num_t JJY_GPIO = static_cast<gpio_num_t>(CONFIG_CLOCKSON_JJY_GPIO);
+
 } // namespace clockson
@@ -0,0 +1,79 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "freertos.h"
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <sdkconfig.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef CONFIG_CLOCKSON_METRICS
+namespace clockson {
+
+class Network;
+class Transmit;
+
+/*
+ * HTTP server for metrics in the Prometheus text exposition format. All of
+ * the values are read from lock-free counters or from the state of the heap
+ * and tasks, so scraping the metrics doesn't delay transmission.
+ */
+class Metrics {
+public:
+	Metrics(Network &network, Transmit &transmit);
+	~Metrics() = delete;
+
+private:
+	static constexpr const char *TAG = "clockson.Metrics";
+	static constexpr uint16_t PORT = CONFIG_CLOCKSON_METRICS_PORT;
+	static constexpr UBaseType_t TASK_PRIORITY = 2;
+	static constexpr uint32_t TASK_STACK_SIZE = 4096;
+	static constexpr size_t BUFFER_SIZE = 512;
+
+	static esp_err_t handler(httpd_req_t *req);
+
+	esp_err_t handler_metrics(httpd_req_t *req);
+	void network_metrics();
+	void transmit_metrics();
+	void heap_metrics();
+	void task_metrics();
+
+	/* Describe a metric, before its values */
+	void metric(const char *name, const char *type, const char *help);
+	/* Append formatted text to the response, sending it in chunks */
+	void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	void flush();
+
+	Network &network_;
+	Transmit &transmit_;
+	httpd_handle_t server_{nullptr};
+	/* Only used by the HTTP server task, one request at a time */
+	httpd_req_t *req_{nullptr};
+	esp_err_t err_{ESP_OK};
+	std::array<char, BUFFER_SIZE> buffer_;
+	size_t length_{0};
+};
+
+} // namespace clockson
+#endif
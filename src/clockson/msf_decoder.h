@@ -0,0 +1,226 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include "calendar.h"
+#include "standard.h"
+
+namespace clockson {
+
+/*
+ * Decoder for MSF time signals from the times of carrier changes, to check
+ * the output of TimeSignal without a receiver. Each second starts with the
+ * carrier off; the minute marker is off for 500ms, otherwise bit A is off for
+ * an extra 100ms and bit B is off for the 100ms after that.
+ *
+ * Changes are matched to the nearest multiple of 100ms from the start of the
+ * second (as a receiver would) and then flagged if they're further than the
+ * tolerance from it. A minute is complete when the next minute marker has
+ * been decoded, 1 second after it ends.
+ */
+class MsfDecoder {
+public:
+	using Calendar = standard::MSF::Calendar;
+	using Frame = standard::MSF::Frame;
+
+	/* Problems with a minute, as flags */
+	static constexpr uint16_t NONE = 0;
+	/* A change is further than the tolerance from when it should be */
+	static constexpr uint16_t PULSE_WIDTH = 1U << 0;
+	/* A second doesn't have a valid pattern of changes */
+	static constexpr uint16_t SYMBOL = 1U << 1;
+	/* There aren't 59 seconds after the minute marker */
+	static constexpr uint16_t LENGTH = 1U << 2;
+	/* Bits A52-A59 aren't the minute identifier 01111110 */
+	static constexpr uint16_t IDENTIFIER = 1U << 3;
+	/* A BCD digit is more than 9 */
+	static constexpr uint16_t BCD = 1U << 4;
+	/* One of the odd parity bits B54-B57 is wrong */
+	static constexpr uint16_t PARITY = 1U << 5;
+	/*
+	 * The fields aren't a valid local time, or don't match its weekday or
+	 * the summer time bits B53 and B58
+	 */
+	static constexpr uint16_t CALENDAR = 1U << 6;
+
+	/* Default tolerance of the time of each change */
+	static constexpr int64_t DEFAULT_TOLERANCE_US = 20000;
+
+	struct Minute {
+		/* Time of the start of the minute marker */
+		int64_t start_us;
+		Frame frame;
+		/* Seconds after the minute marker */
+		unsigned int seconds;
+		uint16_t errors;
+		/* Largest difference of a change from when it should be */
+		uint32_t max_error_us;
+		/* Time that is encoded (UTC), only if there are no errors */
+		uint64_t utc_time;
+
+		inline Calendar calendar() const { return Calendar{(time_t)utc_time}; }
+	};
+
+	/*
+	 * Two digit years are in the range base_year to base_year + 99. Changes
+	 * further than tolerance_us from when they should be are flagged.
+	 */
+	explicit MsfDecoder(unsigned int base_year = 2000,
+		int64_t tolerance_us = DEFAULT_TOLERANCE_US);
+	~MsfDecoder() = default;
+
+	/*
+	 * Add a change of the carrier at ts_us, which must not be before the
+	 * previous change. Returns true when a minute has been completed, which
+	 * is then available from minute().
+	 */
+	inline bool edge(int64_t ts_us, bool carrier) {
+		if (carrier == carrier_) {
+			return false;
+		}
+
+		carrier_ = carrier;
+
+		const int64_t offset_us = ts_us - second_us_;
+
+		if (!carrier && (offset_us >= NEXT_SECOND_US || !in_second_)) {
+			/* Start of the next second */
+			const int64_t length_error_us = std::abs(offset_us - ONE_SECOND_US);
+			const uint8_t symbol = SYMBOLS[steps_];
+			bool complete = false;
+
+			if (in_minute_ && symbol <= (A | B) && seconds_ < SECONDS
+					&& length_error_us < ONE_SECOND_US / 2) {
+				/* Only a data bit to add, see end_second() */
+				seconds_++;
+				a_ |= (uint64_t)(symbol & A) << seconds_;
+				b_ |= (uint64_t)(symbol >> 1) << seconds_;
+				max_error_us_ = std::max({max_error_us_, length_error_us,
+					second_error_us_});
+			} else if (in_second_) {
+				complete = end_second(offset_us);
+			}
+
+			in_second_ = true;
+			second_us_ = ts_us;
+			steps_ = 0;
+			second_error_us_ = 0;
+			return complete;
+		}
+
+		/*
+		 * Match the change to the nearest multiple of 100ms now so that the
+		 * second can be decoded from the steps that have changes with one
+		 * lookup
+		 */
+		const int64_t steps = (offset_us + SYMBOL_STEP_US / 2) / SYMBOL_STEP_US;
+		const int64_t error_us = std::abs(offset_us - steps * SYMBOL_STEP_US);
+		uint32_t step = 1U << std::min((uint64_t)steps, (uint64_t)OTHER_STEP);
+
+		if (steps_ & step) {
+			/* Two changes in the same step can't be decoded */
+			step = 1U << OTHER_STEP;
+		}
+
+		steps_ |= step;
+		second_error_us_ = std::max(second_error_us_, error_us);
+		return false;
+	}
+
+	/* Last minute to be completed */
+	inline const Minute& minute() const { return minute_; }
+
+	/*
+	 * Check the bits of a frame and recover the time that it encodes,
+	 * returning the errors
+	 */
+	static uint16_t decode(const Frame &frame, unsigned int base_year,
+		uint64_t &utc_time);
+
+private:
+	static constexpr int64_t ONE_SECOND_US = 1000000;
+	static constexpr int64_t SYMBOL_STEP_US = 100000;
+	/* The earliest that the next second can start (after the marker) */
+	static constexpr int64_t NEXT_SECOND_US = 700000;
+	static constexpr unsigned int SECONDS = 59;
+	/* Give up on the minute if there's no minute marker after this */
+	static constexpr unsigned int MAX_SECONDS = 61;
+
+	/* Symbols, as A | (B << 1) for bits */
+	static constexpr uint8_t A = 1U << 0;
+	static constexpr uint8_t B = 1U << 1;
+	static constexpr uint8_t MARKER = 1U << 2;
+	static constexpr uint8_t INVALID = 1U << 3;
+
+	/*
+	 * Changes after the minute marker's change (or more than one change in
+	 * the same step) aren't valid
+	 */
+	static constexpr unsigned int OTHER_STEP = 6;
+
+	/*
+	 * Symbol for each set of 100ms steps that have changes after the start
+	 * of a second (A=0 B=1 has 3 changes, the others have 1)
+	 */
+	static constexpr std::array<uint8_t, 2U << OTHER_STEP> SYMBOLS = [] {
+		std::array<uint8_t, 2U << OTHER_STEP> symbols{};
+
+		symbols.fill(INVALID);
+		symbols[1U << 1] = 0;
+		symbols[1U << 2] = A;
+		symbols[(1U << 1) | (1U << 2) | (1U << 3)] = B;
+		symbols[1U << 3] = A | B;
+		symbols[1U << 5] = MARKER;
+		return symbols;
+	}();
+
+	bool end_second(int64_t length_us);
+
+	void finish_minute();
+
+	const unsigned int base_year_;
+	const int64_t tolerance_us_;
+
+	bool carrier_{true};
+	bool in_second_{false};
+	int64_t second_us_{0};
+	/* Bit for each 100ms step of the second that has a change */
+	uint32_t steps_{0};
+	/* Largest difference of a change in the second from its step */
+	int64_t second_error_us_{0};
+
+	bool in_minute_{false};
+	int64_t minute_us_{0};
+	unsigned int seconds_{0};
+	uint16_t errors_{NONE};
+	int64_t max_error_us_{0};
+	uint64_t a_{0};
+	uint64_t b_{0};
+
+	Minute minute_{};
+};
+
+} // namespace clockson
@@ -19,17 +19,26 @@
 #pragma once
 
 #include "freertos.h"
+#include <freertos/task.h>
 
 #include <cstddef>
+#include <cstdint>
+#include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <sdkconfig.h>
 #include <sys/time.h>
 
+#include <array>
 #include <atomic>
-#include <string>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <type_traits>
 
-extern "C" int __wrap_adjtime(const struct timeval *delta,
-	struct timeval *outdelta);
+#include "discipline.h"
+#include "ntp.h"
+#include "spsc_queue.h"
 
 namespace clockson {
 
@@ -38,22 +47,134 @@ namespace network {
 void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
 	void *event_data);
 
-void time_synced(struct timeval *tv);
-
 } // namespace network
 
 class Network {
 public:
+	/* Corrections of the system clock, counted without locking for metrics */
+	struct TimeStats {
+		std::atomic<uint32_t> steps{0};
+		std::atomic<uint32_t> slews{0};
+		/* Adjustments that couldn't be applied to the system clock */
+		std::atomic<uint32_t> failures{0};
+		/* Total size of all slews */
+		std::atomic<uint32_t> slewed_us{0};
+		std::atomic<int32_t> last_slew_us{0};
+		std::atomic<uint32_t> offsets_used{0};
+		std::atomic<uint32_t> offsets_ignored{0};
+		std::atomic<int32_t> last_offset_us{0};
+		/* Estimated frequency error of the system clock */
+		std::atomic<int32_t> frequency_ppb{0};
+		/* Estimated maximum rate of change of the frequency error */
+		std::atomic<int32_t> drift_ppb_per_hour{0};
+	};
+
+	/*
+	 * Estimated error of the system clock after which the time is no longer
+	 * valid, so that time signals continue to be transmitted without syncs
+	 * (holdover) for as long as the clock model allows
+	 */
+	static constexpr double TIME_ERROR_LIMIT_US = CONFIG_CLOCKSON_HOLDOVER_LIMIT_MS * 1000.0;
+
 	Network();
 	~Network() = delete;
 
 	static bool time_ok();
 	static bool time_ok(uint64_t *time_sync_us_out);
+
+	/*
+	 * Uptime when the estimated error of the system clock will exceed the
+	 * limit without another sync, or 0 if it hasn't been synced
+	 */
+	static inline uint64_t time_valid_until_us() {
+		return time_valid_until_us_.load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * Current estimated error of the system clock (see
+	 * ClockDiscipline::error_bound_us()), or infinity if it hasn't been synced.
+	 * This doesn't take the lock, so it can be read at any time.
+	 */
+	static double time_error_bound_us();
+
+	/*
+	 * Uptime when the estimated error of the system clock will exceed
+	 * limit_us without another sync, or 0 if it hasn't been synced
+	 */
+	static uint64_t time_error_limit_uptime_us(double limit_us);
+
+	/* Uptime when the time was first synced, or 0 if it hasn't been */
+	static uint64_t time_first_sync_us();
+
+	/*
+	 * Apply the next correction to the system clock, between transmissions
+	 * so that it doesn't affect the current time signal
+	 */
 	static void time_slew_next();
 
-	void syslog(std::string_view message);
+	/*
+	 * Rate of uptime relative to the reference time, for a ClockMapping,
+	 * from the estimated frequency error of the system clock
+	 */
+	static int64_t time_rate();
+
+	static inline const TimeStats& time_stats() { return time_stats_; }
+
+	/* Current time of the system clock */
+	static uint64_t wall_us();
+
+	/*
+	 * Use the current offset of the system clock from the reference time,
+	 * as measured by NTP
+	 */
+	static void time_offset(int64_t offset_us);
+
+	/*
+	 * Queue a message to be formatted and logged (to the console and
+	 * syslog) by a low priority task, so that the caller is never delayed
+	 * by formatting or the network. The message is a trivially copyable
+	 * object with a "size_t format(char *text, size_t size) const" method.
+	 *
+	 * Only one task may log messages this way. If the queue is full then
+	 * the message is dropped and counted.
+	 */
+	template <class T>
+	void syslog(esp_log_level_t level, const char *tag, const T &message) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		static_assert(sizeof(T) <= SyslogRecord::DATA_SIZE);
+		static_assert(alignof(T) <= alignof(SyslogRecord));
+
+		SyslogRecord record;
+
+		record.format = [] (const void *data, char *text, size_t size) {
+			return std::launder(reinterpret_cast<const T*>(data))->format(text, size);
+		};
+		record.tag = tag;
+		record.level = level;
+		record.uptime_us = esp_timer_get_time();
+		std::memcpy(record.data.data(), &message, sizeof(T));
+
+		if (!syslog_queue_.push(record)) {
+			syslog_dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	/* Messages that were dropped because the queue was full */
+	inline uint32_t syslog_dropped() const { return syslog_dropped_; }
+	/* Messages that couldn't be sent to the syslog server */
+	inline uint32_t syslog_errors() const { return syslog_errors_; }
 
 private:
+	struct alignas(8) SyslogRecord {
+		static constexpr size_t DATA_SIZE = 96;
+
+		size_t (*format)(const void *data, char *text, size_t size);
+		const char *tag;
+		esp_log_level_t level;
+		uint64_t uptime_us;
+		std::array<uint8_t, DATA_SIZE> data;
+	};
+
 	static constexpr const char *TAG = "clockson.Network";
 	/*
 	 * Maximum smooth time adjustment is 750ms, which will take 30 minutes when
@@ -66,27 +187,75 @@ private:
 	 * signal or going beyond receiver timing tolerances
 	 */
 	static constexpr suseconds_t UPPER_TIME_SLEW_US = 25000;
-	static constexpr suseconds_t LOWER_TIME_SLEW_US = -UPPER_TIME_SLEW_US;
 	static constexpr suseconds_t ONE_SECOND_US = 1000000;
 
+	/* Core for the network tasks, away from the transmit path */
+	static constexpr BaseType_t TASK_CORE = CONFIG_CLOCKSON_NETWORK_CORE;
+
+	static constexpr size_t SYSLOG_QUEUE_SIZE = 16;
+	static constexpr uint32_t SYSLOG_TASK_STACK_SIZE = 4096;
+	static constexpr UBaseType_t SYSLOG_TASK_PRIORITY = 1;
+	static constexpr uint32_t SYSLOG_INTERVAL_MS = 100;
+	static constexpr size_t SYSLOG_MAX_LENGTH = 320;
+	static constexpr uint64_t REPORT_INTERVAL_US = 15 * 60 * 1000000ULL;
+
+	static constexpr uint32_t NTP_TASK_STACK_SIZE = 4096;
+	static constexpr UBaseType_t NTP_TASK_PRIORITY = 3;
+	static constexpr uint32_t NTP_POLL_INTERVAL_MS = CONFIG_LWIP_SNTP_UPDATE_DELAY;
+	static constexpr uint32_t NTP_TIMEOUT_MS = 1000;
+	/*
+	 * Until the time is synced, the servers are polled in a burst so that
+	 * the lowest delay samples can be used to set the time within seconds
+	 */
+	static constexpr unsigned int NTP_BURST_POLLS = 4;
+	static constexpr uint32_t NTP_BURST_INTERVAL_MS = 2000;
+	static constexpr uint32_t NTP_BURST_RETRY_MS = 10000;
+
 	friend void network::event_handler(void *arg, esp_event_base_t event_base,
 		int32_t event_id, void *event_data);
-	friend void network::time_synced(struct timeval *tv);
-	friend int ::__wrap_adjtime(const struct timeval *delta,
-		struct timeval *outdelta);
 
-	static void time_synced(struct timeval *tv);
-	static int adjtime(const struct timeval *delta, struct timeval *outdelta);
+	static uint64_t uptime_us();
+	static int64_t time_applied_us();
+
+	/* Add adjust_us to the system clock, with time_mutex_ locked */
+	static bool time_adjust(int64_t adjust_us);
+
+	static void ntp_task(void *arg);
+	static void syslog_task(void *arg);
 
 	void event_handler(esp_event_base_t event_base, int32_t event_id,
 		void *event_data);
+	[[noreturn]] void ntp_task();
+	void ntp_servers();
+	[[noreturn]] void syslog_task();
+	void syslog_send(esp_log_level_t level, uint64_t uptime_us, const char *text);
+
+	static ClockDiscipline::Bound time_bound();
 
 	static uint64_t time_sync_us_;
+	static uint64_t time_first_sync_us_;
+	static std::atomic<uint64_t> time_valid_until_us_;
+	static std::mutex time_mutex_;
 	static bool time_step_first_;
-	static std::atomic<int> time_slew_allowed_;
-	static int time_slew_current_;
+	static ClockDiscipline time_discipline_;
+	/* Total of the adjustments applied to the system clock */
+	static int64_t time_applied_us_;
+	static TimeStats time_stats_;
+	/*
+	 * Error bound from the last sync, so that it can be read without the
+	 * lock (the phase is infinite until the first sync). Each sync writes
+	 * to the slot that isn't current and then increments the sequence
+	 * number to switch to it, see time_bound().
+	 */
+	static std::array<ClockDiscipline::Bound, 2> time_bound_;
+	static std::atomic<uint32_t> time_bound_seq_;
 
 	int syslog_{-1};
+	SpscQueue<SyslogRecord, SYSLOG_QUEUE_SIZE> syslog_queue_;
+	std::atomic<uint32_t> syslog_dropped_{0};
+	std::atomic<uint32_t> syslog_errors_{0};
+	NtpClient ntp_{wall_us, uptime_us, time_applied_us};
+	TaskHandle_t ntp_task_{nullptr};
 };
 
 } // namespace clockson
@@ -0,0 +1,221 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace clockson {
+
+/*
+ * Statistics for one NTP server, from a filter of its most recent samples.
+ * The sample with the lowest round trip delay is the one least affected by
+ * queueing (and therefore delay asymmetry) so it's used as the offset of the
+ * server, with the spread of the other samples as its jitter.
+ */
+class NtpServer {
+public:
+	struct Sample {
+		/* Offset of the uncorrected system clock (reference minus system) */
+		int64_t offset_us;
+		/* Round trip delay */
+		int64_t delay_us;
+		/* Half the root delay plus the root dispersion of the server */
+		int64_t dispersion_us;
+		uint64_t uptime_us;
+	};
+
+	enum class State : uint8_t {
+		NONE,
+		/* Outside of the intersection of the majority of servers */
+		FALSETICKER,
+		/* Removed because it was the furthest from the other servers */
+		OUTLIER,
+		/* Used for the combined offset */
+		SURVIVOR,
+	};
+
+	/* Number of samples in the filter */
+	static constexpr size_t FILTER_SIZE = 8;
+	/* Rate at which the error of a sample increases as it ages (15ppm) */
+	static constexpr double PHI = 15e-6;
+
+	NtpServer() = default;
+	~NtpServer() = default;
+
+	/* Add a sample from a successful poll */
+	void add(const Sample &sample);
+	/* Record a poll that had no response */
+	void missed();
+	/* Forget everything about the server */
+	void reset();
+
+	/* Samples are only used when at least one of the last 8 polls succeeded */
+	inline bool valid() const { return count_ > 0 && reach_ != 0; }
+	inline uint8_t reach() const { return reach_; }
+	inline State state() const { return state_; }
+	inline void state(State state) { state_ = state; }
+
+	inline const Sample& best() const { return filter_[best_]; }
+	inline const Sample& last() const { return filter_[(next_ + FILTER_SIZE - 1) % FILTER_SIZE]; }
+	inline double jitter_us() const { return jitter_us_; }
+
+	/* Maximum error of the best sample at uptime_us */
+	double distance_us(uint64_t uptime_us) const;
+
+private:
+	/* Lower limit for the jitter so that servers are never exact */
+	static constexpr double MIN_JITTER_US = 1.0;
+
+	std::array<Sample, FILTER_SIZE> filter_{};
+	size_t count_{0};
+	size_t next_{0};
+	size_t best_{0};
+	double jitter_us_{MIN_JITTER_US};
+	uint8_t reach_{0};
+	State state_{State::NONE};
+};
+
+/*
+ * Combination of the servers that agree with each other, from an intersection
+ * of their offsets (Marzullo's algorithm, as used by NTP to find the
+ * truechimers) followed by clustering to remove the servers that are furthest
+ * from the others.
+ */
+struct NtpSelection {
+	bool valid;
+	/* Offset of the current system clock (reference minus system) */
+	int64_t offset_us;
+	double jitter_us;
+	unsigned int candidates;
+	unsigned int falsetickers;
+	unsigned int survivors;
+
+	/*
+	 * Select from the servers at uptime_us, applied_us is the total of the
+	 * adjustments that have been applied to the system clock. The state of
+	 * each server is updated.
+	 */
+	static NtpSelection select(std::span<NtpServer> servers,
+		uint64_t uptime_us, int64_t applied_us);
+
+	static constexpr size_t MAX_CANDIDATES = 16;
+
+private:
+	/* Clustering stops when this number of servers remain */
+	static constexpr unsigned int MIN_SURVIVORS = 3;
+	/* Servers that are further away than this (1s) are never used */
+	static constexpr double MAX_DISTANCE_US = 1000000.0;
+};
+
+/*
+ * Client that polls every configured NTP server at the same time using a
+ * single IPv4 UDP socket.
+ */
+class NtpClient {
+public:
+	static constexpr size_t MAX_SERVERS = NtpSelection::MAX_CANDIDATES;
+	static constexpr uint16_t PORT = 123;
+
+	/* Times in microseconds */
+	using clock_t = uint64_t (*)();
+	/* Total of the adjustments applied to the system clock */
+	using applied_t = int64_t (*)();
+
+	/*
+	 * The wall clock must be the system clock that is being corrected,
+	 * uptime must be monotonic
+	 */
+	NtpClient(clock_t wall, clock_t uptime, applied_t applied);
+	~NtpClient();
+
+	NtpClient(const NtpClient&) = delete;
+	NtpClient& operator=(const NtpClient&) = delete;
+
+	/*
+	 * Set the address of a server (nullptr to remove it). The statistics
+	 * for that server are reset if the address has changed.
+	 */
+	void server(size_t index, const struct sockaddr_in *addr);
+	inline const NtpServer& server(size_t index) const { return stats_[index]; }
+	inline bool configured(size_t index) const { return servers_[index].configured; }
+	inline const struct sockaddr_in& address(size_t index) const { return servers_[index].addr; }
+
+	/*
+	 * Send a request to every server and wait up to timeout_ms for the
+	 * responses. Returns false if the system clock was adjusted while
+	 * polling, in which case the responses are discarded.
+	 */
+	bool poll(uint32_t timeout_ms);
+
+	/* Combine the servers, see NtpSelection */
+	NtpSelection select();
+
+	/* Convert between Unix time in microseconds and NTP timestamps */
+	static uint64_t to_ntp(uint64_t wall_us);
+	/*
+	 * The era is the one closest to reference_us (but not before 2036, see
+	 * ERA_PIVOT_S). Returns 0 if the timestamp is before 1970.
+	 */
+	static uint64_t from_ntp(uint64_t ts, uint64_t reference_us);
+
+private:
+	struct Server {
+		struct sockaddr_in addr{};
+		bool configured{false};
+		bool pending{false};
+		/* Transmit timestamp of the request, expected as the origin */
+		uint64_t request_ts{0};
+		uint64_t request_us{0};
+		/* Response to the current poll */
+		bool received{false};
+		NtpServer::Sample sample{};
+	};
+
+	static constexpr size_t PACKET_SIZE = 48;
+	/* Seconds from 1900-01-01 to 1970-01-01 */
+	static constexpr uint64_t EPOCH_OFFSET_S = 2208988800ULL;
+	/*
+	 * Earliest reference time for the NTP era (2036-02-07, the start of era
+	 * 1), because the system clock starts at 1970 until it has been synced.
+	 * Timestamps from 1968 to 2104 are decoded correctly before then, like
+	 * the lwIP SNTP client which uses the most significant bit.
+	 */
+	static constexpr uint64_t ERA_PIVOT_S = 1ULL << 32;
+	static uint64_t read64(const uint8_t *data);
+	static uint32_t read32(const uint8_t *data);
+	static void write64(uint8_t *data, uint64_t value);
+
+	bool open();
+	void receive(Server &server, const uint8_t *packet, uint64_t receive_us,
+		int64_t applied_us);
+
+	const clock_t wall_;
+	const clock_t uptime_;
+	const applied_t applied_;
+	std::array<Server, MAX_SERVERS> servers_{};
+	std::array<NtpServer, MAX_SERVERS> stats_{};
+	int socket_{-1};
+};
+
+} // namespace clockson
@@ -0,0 +1,119 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sdkconfig.h>
+
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+#include <esp_err.h>
+#include <esp_pm.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Light sleep and frequency scaling between output changes. The CPU is kept
+ * awake at full speed from a margin before each output change until it has
+ * happened, so that waking up from light sleep doesn't make it late.
+ *
+ * The margin calibrates itself from how late each wake up is: it follows
+ * the (slowly decaying) peak wake up latency with some headroom.
+ */
+class PowerSave {
+public:
+	static constexpr uint32_t INITIAL_MARGIN_US = 2000;
+	static constexpr uint32_t MIN_MARGIN_US = 250;
+	static constexpr uint32_t MAX_MARGIN_US = 20000;
+	static constexpr size_t MAX_LENGTH = 128;
+
+	struct Totals {
+		uint64_t sleep_us;
+		uint32_t sleeps;
+		uint32_t wakes;
+		/* Wake ups that were later than the margin at the time */
+		uint32_t late_wakes;
+		uint32_t margin_us;
+	};
+
+	PowerSave() = delete;
+
+	/* Enable light sleep and frequency scaling */
+	static void init();
+
+	/* Time to wake up before an output change at signal_us */
+	static inline uint64_t wake_us(uint64_t signal_us) {
+		return signal_us - std::min(signal_us, (uint64_t)margin_us_.load(std::memory_order_relaxed));
+	}
+
+	/*
+	 * Allow light sleep until wake_us (which is 0 if the next wake up isn't
+	 * for an output change)
+	 */
+	static void sleep(uint64_t wake_us);
+
+	/* Stay awake at full speed until the next call to sleep() */
+	static void wake(uint64_t uptime_us);
+
+	static Totals totals();
+
+	/*
+	 * Report the time spent in light sleep since the last report, calling
+	 * func(text)
+	 */
+	template <class F>
+	static void report(F &&func) {
+		std::array<char, MAX_LENGTH> text;
+
+		summary(text.data(), text.size());
+		func(text.data());
+	}
+
+private:
+	/* Number of wake ups for the peak latency to decay by ~63% */
+	static constexpr uint32_t PEAK_DECAY = 64;
+
+	static esp_err_t sleep_enter(int64_t sleep_time_us, void *arg);
+	static esp_err_t sleep_exit(int64_t sleep_time_us, void *arg);
+	static void summary(char *text, size_t size);
+
+	static esp_pm_lock_handle_t no_light_sleep_;
+	static esp_pm_lock_handle_t cpu_freq_max_;
+	/* Only used by the transmit timer */
+	static bool awake_;
+	static uint64_t wake_us_;
+	static uint32_t peak_us_;
+	static std::atomic<uint32_t> margin_us_;
+	static std::atomic<uint32_t> wakes_;
+	static std::atomic<uint32_t> late_wakes_;
+	/* Only used by the idle task */
+	static uint64_t sleep_start_us_;
+	static std::atomic<uint64_t> sleep_us_;
+	static std::atomic<uint32_t> sleeps_;
+	/* Only used by the report */
+	static uint64_t reported_us_;
+	static uint64_t reported_sleep_us_;
+};
+
+} // namespace clockson
+#endif
@@ -0,0 +1,199 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "clock_mapping.h"
+#include "time_signal.h"
+
+namespace clockson {
+
+/*
+ * Time signals for multiple standards, one per output, merged into a single
+ * time-ordered sequence of changes so that they can all be transmitted from
+ * one timer. Outputs that aren't enabled never have any changes.
+ */
+template <class... Standards>
+class Schedule {
+public:
+	static constexpr size_t SIZE = sizeof...(Standards);
+
+	/* No outputs enabled, to be assigned later */
+	Schedule() : Schedule(std::array<bool, SIZE>{}) {}
+
+	explicit Schedule(const std::array<bool, SIZE> &enabled) : enabled_(enabled) {
+		next_.fill(Signal{NONE, false});
+	}
+	~Schedule() = default;
+
+	/* Start the time signals for the minute starting at t */
+	void start(time_t t, const ClockMapping &clock) {
+		for_each([t, &clock] (size_t, auto &signal) {
+			signal = signal.at_minute(t, clock);
+		});
+		update_all();
+	}
+
+	/* Continue with the time signals for the following minute */
+	void next_minute(const ClockMapping &clock) {
+		for_each([&clock] (size_t, auto &signal) {
+			signal = signal.next_minute(clock);
+		});
+		update_all();
+	}
+
+	inline bool available() const { return next_[output_].ts != NONE; }
+	inline Signal next() const { return next_[output_]; }
+
+	/* Output of the next change */
+	inline size_t output() const { return output_; }
+
+	inline void pop() {
+		visit(output_, [] (auto &signal) { signal.pop(); });
+		update(output_);
+		select();
+	}
+
+	inline bool enabled(size_t output) const { return enabled_[output]; }
+
+	/* Longest time between changes of any enabled output */
+	uint64_t max_gap_us() const {
+		uint64_t gap_us = 0;
+
+		for_each([&gap_us] (size_t, const auto &signal) {
+			gap_us = std::max<uint64_t>(gap_us,
+				std::remove_cvref_t<decltype(signal)>::MAX_GAP_MS * 1000ULL);
+		});
+
+		return gap_us;
+	}
+
+	/* Call func(output, signal) for the time signal of every enabled output */
+	template <class F>
+	void for_each(F &&func) {
+		for_each(std::forward<F>(func), std::index_sequence_for<Standards...>{});
+	}
+
+	template <class F>
+	void for_each(F &&func) const {
+		for_each(std::forward<F>(func), std::index_sequence_for<Standards...>{});
+	}
+
+	/* Time encoded by each time signal, 0 if the output isn't enabled */
+	std::array<uint64_t, SIZE> times() const {
+		std::array<uint64_t, SIZE> times{};
+
+		for_each([&times] (size_t output, const auto &signal) {
+			times[output] = signal.time().utc_time();
+		});
+
+		return times;
+	}
+
+	/*
+	 * Write the name and local time of each time signal to text, from times
+	 * that were saved earlier so that this can be done elsewhere
+	 */
+	static size_t describe(char *text, size_t size,
+			const std::array<uint64_t, SIZE> &times) {
+		return describe(text, size, times, std::index_sequence_for<Standards...>{});
+	}
+
+private:
+	static constexpr int64_t NONE = std::numeric_limits<int64_t>::max();
+
+	template <class F, size_t... I>
+	void for_each(F &&func, std::index_sequence<I...>) {
+		((enabled_[I] ? func(I, std::get<I>(signals_)) : void()), ...);
+	}
+
+	template <class F, size_t... I>
+	void for_each(F &&func, std::index_sequence<I...>) const {
+		((enabled_[I] ? func(I, std::get<I>(signals_)) : void()), ...);
+	}
+
+	template <size_t... I>
+	static size_t describe(char *text, size_t size,
+			const std::array<uint64_t, SIZE> &times, std::index_sequence<I...>) {
+		size_t length = 0;
+
+		auto append = [&] (size_t output, const char *name, auto calendar) {
+			if (times[output] && length < size) {
+				length += std::snprintf(text + length, size - length, "%s%s %s",
+					length ? " " : "", name, calendar.to_string().data());
+			}
+		};
+
+		(append(I, BasicTimeSignal<Standards>::NAME,
+			typename BasicTimeSignal<Standards>::Calendar{(time_t)times[I]}), ...);
+		return std::min(length, size);
+	}
+
+	template <class F>
+	inline void visit(size_t output, F &&func) {
+		visit(output, std::forward<F>(func), std::index_sequence_for<Standards...>{});
+	}
+
+	template <class F, size_t... I>
+	inline void visit(size_t output, F &&func, std::index_sequence<I...>) {
+		((I == output ? func(std::get<I>(signals_)) : void()), ...);
+	}
+
+	inline void update(size_t output) {
+		visit(output, [this, output] (auto &signal) {
+			next_[output] = signal.available() ? signal.next() : Signal{NONE, false};
+		});
+	}
+
+	void update_all() {
+		for (size_t i = 0; i < SIZE; i++) {
+			update(i);
+		}
+
+		select();
+	}
+
+	/* There are only a few outputs so a linear search is fast enough */
+	inline void select() {
+		output_ = 0;
+
+		for (size_t i = 1; i < SIZE; i++) {
+			if (next_[i].ts < next_[output_].ts) {
+				output_ = i;
+			}
+		}
+	}
+
+	std::array<bool, SIZE> enabled_;
+	std::tuple<BasicTimeSignal<Standards>...> signals_;
+	std::array<Signal, SIZE> next_;
+	size_t output_{0};
+};
+
+} // namespace clockson
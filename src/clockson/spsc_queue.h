@@ -0,0 +1,79 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace clockson {
+
+/*
+ * Bounded lock-free queue with one producer and one consumer. Each side only
+ * modifies its own index, so neither of them can be blocked by the other.
+ */
+template <class T, size_t SIZE>
+class SpscQueue {
+public:
+	static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+	SpscQueue() = default;
+	~SpscQueue() = default;
+
+	/* Add a value to the queue, returns false if it's full */
+	inline bool push(const T &value) {
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+
+		if (tail - head_.load(std::memory_order_acquire) == SIZE) {
+			return false;
+		}
+
+		items_[tail % SIZE] = value;
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* The queue is full, only valid for the producer */
+	inline bool full() const {
+		return tail_.load(std::memory_order_relaxed)
+			- head_.load(std::memory_order_acquire) == SIZE;
+	}
+
+	/* Remove a value from the queue, returns false if it's empty */
+	inline bool pop(T &value) {
+		const size_t head = head_.load(std::memory_order_relaxed);
+
+		if (tail_.load(std::memory_order_acquire) == head) {
+			return false;
+		}
+
+		value = items_[head % SIZE];
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::array<T, SIZE> items_{};
+	/* Only modified by the consumer */
+	std::atomic<size_t> head_{0};
+	/* Only modified by the producer */
+	std::atomic<size_t> tail_{0};
+};
+
+} // namespace clockson
@@ -0,0 +1,192 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+#include "calendar.h"
+
+namespace clockson {
+
+/*
+ * Carrier changes within a second, starting at the beginning of the second
+ * and then alternating between on and off
+ */
+struct Symbol {
+	uint8_t count;
+	std::array<uint16_t, 4> offset_ms;
+};
+
+/*
+ * Encoding policies for each time signal standard. Each standard encodes a
+ * frame of 60 seconds for a Calendar in its own local time, and then the
+ * symbol for each second is looked up from the frame while transmitting.
+ */
+namespace standard {
+
+using data_t = std::bitset<60>;
+
+/* Set BCD digits, most significant bit first */
+void set_bcd(data_t &data, size_t begin, size_t end, unsigned int value);
+
+/* Set BCD digits, least significant bit first */
+void set_bcd_lsb(data_t &data, size_t begin, size_t end, unsigned int value);
+
+/* Parity bit that makes the number of set bits odd */
+bool odd_parity(const data_t &data, size_t begin, size_t end);
+
+/* Parity bit that makes the number of set bits even */
+inline bool even_parity(const data_t &data, size_t begin, size_t end) {
+	return !odd_parity(data, begin, end);
+}
+
+/* "Time from NPL" (UK) */
+struct MSF {
+	using Calendar = BasicCalendar<zone::UK>;
+
+	struct Frame {
+		data_t a;
+		data_t b;
+	};
+
+	static constexpr const char *NAME = "MSF";
+
+	/* The time signal during each minute is for the following minute */
+	static constexpr bool NEXT_MINUTE = true;
+
+	/* Carrier level after the first change in each second */
+	static constexpr bool FIRST_CARRIER = false;
+
+	static constexpr size_t MINUTE_MARKER = 4;
+
+	/* Longest time between changes (after A=0 B=0) */
+	static constexpr unsigned int MAX_GAP_MS = 900;
+
+	/* Indexed by A | (B << 1), followed by the minute marker */
+	static constexpr std::array<Symbol, 5> SYMBOLS{{
+		{2, {0, 100}},           /* A=0 B=0 */
+		{2, {0, 200}},           /* A=1 B=0 */
+		{4, {0, 100, 200, 300}}, /* A=0 B=1 */
+		{2, {0, 300}},           /* A=1 B=1 */
+		{2, {0, 500}},           /* Minute marker */
+	}};
+
+	static inline size_t symbol_index(const Frame &frame, uint8_t second) {
+		return second == 0 ? MINUTE_MARKER : (frame.a[second] | (frame.b[second] << 1));
+	}
+
+	/*
+	 * Encode the time in a frame, updating only the fields that have changed
+	 * if the frame contains the previous time
+	 */
+	static void encode(Frame &frame, const Calendar &time, const Calendar *previous);
+};
+
+/* Germany */
+struct DCF77 {
+	using Calendar = BasicCalendar<zone::CET>;
+	using Frame = data_t;
+
+	static constexpr const char *NAME = "DCF77";
+	static constexpr bool NEXT_MINUTE = true;
+	static constexpr bool FIRST_CARRIER = false;
+
+	/* The minute marker is the absence of a change in the last second */
+	static constexpr size_t MINUTE_MARKER = 2;
+
+	/* Longest time between changes (after a 0 before the minute marker) */
+	static constexpr unsigned int MAX_GAP_MS = 1900;
+
+	static constexpr std::array<Symbol, 3> SYMBOLS{{
+		{2, {0, 100}}, /* 0 */
+		{2, {0, 200}}, /* 1 */
+		{0, {}},       /* Minute marker */
+	}};
+
+	static inline size_t symbol_index(const Frame &frame, uint8_t second) {
+		return second == 59 ? MINUTE_MARKER : frame[second];
+	}
+
+	static void encode(Frame &frame, const Calendar &time, const Calendar *previous);
+};
+
+/* United States (amplitude modulation only) */
+struct WWVB {
+	using Calendar = BasicCalendar<zone::UTC>;
+	using Frame = data_t;
+
+	static constexpr const char *NAME = "WWVB";
+
+	/* The time signal during each minute is for the current minute */
+	static constexpr bool NEXT_MINUTE = false;
+	static constexpr bool FIRST_CARRIER = false;
+
+	static constexpr size_t MARKER = 2;
+
+	/* Longest time between changes (after a 0) */
+	static constexpr unsigned int MAX_GAP_MS = 800;
+
+	static constexpr std::array<Symbol, 3> SYMBOLS{{
+		{2, {0, 200}}, /* 0 */
+		{2, {0, 500}}, /* 1 */
+		{2, {0, 800}}, /* Marker */
+	}};
+
+	static inline size_t symbol_index(const Frame &frame, uint8_t second) {
+		return (second == 0 || second % 10 == 9) ? MARKER : frame[second];
+	}
+
+	static void encode(Frame &frame, const Calendar &time, const Calendar *previous);
+};
+
+/* Japan (without the call sign at 15 and 45 minutes past the hour) */
+struct JJY {
+	using Calendar = BasicCalendar<zone::JST>;
+	using Frame = data_t;
+
+	static constexpr const char *NAME = "JJY";
+	static constexpr bool NEXT_MINUTE = false;
+
+	/* The carrier is on at the start of each second */
+	static constexpr bool FIRST_CARRIER = true;
+
+	static constexpr size_t MARKER = 2;
+
+	/* Longest time between changes (during a 0) */
+	static constexpr unsigned int MAX_GAP_MS = 800;
+
+	static constexpr std::array<Symbol, 3> SYMBOLS{{
+		{2, {0, 800}}, /* 0 */
+		{2, {0, 500}}, /* 1 */
+		{2, {0, 200}}, /* Marker */
+	}};
+
+	static inline size_t symbol_index(const Frame &frame, uint8_t second) {
+		return (second == 0 || second % 10 == 9) ? MARKER : frame[second];
+	}
+
+	static void encode(Frame &frame, const Calendar &time, const Calendar *previous);
+};
+
+} // namespace standard
+
+} // namespace clockson
@@ -0,0 +1,55 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "freertos.h"
+#include <freertos/event_groups.h>
+
+#include <cstdint>
+
+namespace clockson {
+
+/*
+ * Changes of status that are shown by the user interface, so that it can
+ * wait for them instead of polling
+ */
+class Status {
+public:
+	/* The time has been synced */
+	static constexpr EventBits_t TIME_SYNC = 1U << 0;
+	/* Transmission has started or stopped */
+	static constexpr EventBits_t TRANSMIT = 1U << 1;
+	static constexpr EventBits_t ALL = TIME_SYNC | TRANSMIT;
+
+	Status() = delete;
+
+	static void changed(EventBits_t bits);
+
+	/*
+	 * Wait for a change of status or until the timeout expires (UINT64_MAX
+	 * to wait indefinitely), returning the changes (which are then cleared)
+	 */
+	static EventBits_t wait(uint64_t timeout_us);
+
+private:
+	static StaticEventGroup_t buffer_;
+	static EventGroupHandle_t events_;
+};
+
+} // namespace clockson
@@ -0,0 +1,103 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "freertos.h"
+#include <freertos/task.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace clockson {
+
+/*
+ * CPU time used by each task, from the FreeRTOS run-time stats. The run-time
+ * counters are only 32-bit (in microseconds), so they need to be sampled at
+ * least once an hour to accumulate the total without missing a wrap.
+ */
+class TaskUsage {
+public:
+	static constexpr size_t MAX_TASKS = 32;
+	static constexpr size_t MAX_LENGTH = 128;
+
+	TaskUsage() = delete;
+
+	/* Sample the run-time counters of all tasks */
+	static bool update();
+
+	/*
+	 * Report the CPU usage of each task since the last report, calling
+	 * func(text) for each line
+	 */
+	template <class F>
+	static void report(F &&func) {
+		std::array<char, MAX_LENGTH> text;
+		std::lock_guard lock{mutex_};
+
+		for (size_t i = 0; i < MAX_TASKS; i++) {
+			if (task(i, text.data(), text.size())) {
+				func(text.data());
+			}
+		}
+
+		reported_us_ = sample_us_;
+	}
+
+	/*
+	 * Call func(name, core, total_us, stack_free) with the total CPU time
+	 * used by each task (where core is -1 for tasks that can run on any core)
+	 * and its minimum free stack space, as of the last update
+	 */
+	template <class F>
+	static void totals(F &&func) {
+		std::lock_guard lock{mutex_};
+
+		for (const auto &task : tasks_) {
+			if (task.number) {
+				func(task.name.data(), task.core, task.total_us, task.stack_free);
+			}
+		}
+	}
+
+private:
+	struct Task {
+		/* Unique task number, or 0 if this entry is not in use */
+		UBaseType_t number{0};
+		std::array<char, configMAX_TASK_NAME_LEN> name{};
+		int core{-1};
+		UBaseType_t stack_free{0};
+		uint32_t counter{0};
+		uint64_t total_us{0};
+		uint64_t reported_us{0};
+		bool present{false};
+	};
+
+	static Task* find(UBaseType_t number);
+	static bool task(size_t index, char *text, size_t size);
+
+	static std::mutex mutex_;
+	static std::array<TaskStatus_t, MAX_TASKS> status_;
+	static std::array<Task, MAX_TASKS> tasks_;
+	static uint64_t sample_us_;
+	static uint64_t reported_us_;
+};
+
+} // namespace clockson
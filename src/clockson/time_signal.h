@@ -18,13 +18,13 @@
 
 #pragma once
 
-#include <bitset>
 #include <cstddef>
 #include <cstdint>
 #include <ctime>
-#include <deque>
 
 #include "calendar.h"
+#include "clock_mapping.h"
+#include "standard.h"
 
 namespace clockson {
 
@@ -35,26 +35,100 @@ struct Signal {
 	inline uint64_t unsigned_ts() const { return ts < 0 ? 0 : ts; }
 };
 
-class TimeSignal {
+template <class Standard>
+class BasicTimeSignal {
 public:
-	TimeSignal();
-	explicit TimeSignal(time_t t, uint64_t offset_us);
-	~TimeSignal() = default;
+	using Calendar = typename Standard::Calendar;
 
-	inline bool available() { return !values_.empty(); }
-	inline Signal next() { return values_.front(); }
-	inline void pop() { values_.pop_front(); }
+	static constexpr const char *NAME = Standard::NAME;
+	static constexpr unsigned int MAX_GAP_MS = Standard::MAX_GAP_MS;
+
+	BasicTimeSignal();
+	explicit BasicTimeSignal(time_t t, const ClockMapping &clock);
+	~BasicTimeSignal() = default;
+
+	/* Time signal that is transmitted during the minute starting at t */
+	static inline BasicTimeSignal at_minute(time_t t, const ClockMapping &clock) {
+		return BasicTimeSignal{Standard::NEXT_MINUTE ? t + 60 : t, clock};
+	}
+
+	/*
+	 * Time signal for the following minute, updating only the fields that
+	 * have changed since this one
+	 */
+	BasicTimeSignal next_minute(const ClockMapping &clock) const;
+
+	inline bool available() const { return second_ < SECONDS; }
+
+	inline Signal next() const {
+		const Symbol &symbol = Standard::SYMBOLS[symbol_index(second_)];
+		const int64_t elapsed_us = second_ * ONE_SECOND_US
+			+ symbol.offset_ms[edge_] * ONE_MILLISECOND_US;
+
+		return {
+			start_us_ + elapsed_us + ((elapsed_us * rate_) >> ClockMapping::RATE_SHIFT),
+			((edge_ & 1) != 0) != Standard::FIRST_CARRIER
+		};
+	}
+
+	inline void pop() {
+		if (++edge_ == Standard::SYMBOLS[symbol_index(second_)].count) {
+			edge_ = 0;
+			second_++;
+			skip_empty();
+		}
+	}
 
 	inline const Calendar& time() const { return time_; }
 
 private:
-	using data_t = std::bitset<60>;
+	static constexpr uint8_t SECONDS = 60;
+	static constexpr int64_t ONE_SECOND_US = 1000000;
+	static constexpr int64_t ONE_MILLISECOND_US = 1000;
 
-	static void set_bcd(data_t &data, size_t begin, size_t end, unsigned int value);
-	static bool odd_parity(const data_t &data, size_t begin, size_t end);
+	static constexpr bool has_empty_symbols() {
+		for (const auto &symbol : Standard::SYMBOLS) {
+			if (symbol.count == 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	BasicTimeSignal(const BasicTimeSignal &previous, const ClockMapping &clock);
+
+	inline size_t symbol_index(uint8_t second) const {
+		return Standard::symbol_index(frame_, second);
+	}
+
+	/* Skip over seconds that have no changes */
+	inline void skip_empty() {
+		if constexpr (has_empty_symbols()) {
+			while (second_ < SECONDS
+					&& Standard::SYMBOLS[symbol_index(second_)].count == 0) {
+				second_++;
+			}
+		}
+	}
+
+	void start(const ClockMapping &clock);
 
 	Calendar time_;
-	std::deque<Signal> values_;
+	typename Standard::Frame frame_{};
+	/* Uptime at the start of the minute */
+	int64_t start_us_{0};
+	/* Rate of uptime relative to the wall clock (see ClockMapping) */
+	int64_t rate_{0};
+	uint8_t second_{SECONDS};
+	uint8_t edge_{0};
 };
 
+extern template class BasicTimeSignal<standard::MSF>;
+extern template class BasicTimeSignal<standard::DCF77>;
+extern template class BasicTimeSignal<standard::WWVB>;
+extern template class BasicTimeSignal<standard::JJY>;
+
+using TimeSignal = BasicTimeSignal<standard::MSF>;
+
 } // namespace clockson
@@ -18,43 +18,301 @@
 
 #pragma once
 
+#include "freertos.h"
+
 #include <esp_timer.h>
 #include <driver/gpio.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+# include <driver/gptimer.h>
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+# include <driver/rmt_tx.h>
+#elif defined(CONFIG_CLOCKSON_OUTPUT_CARRIER)
+# include <driver/ledc.h>
+#endif
 
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
 
-#include "time_signal.h"
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+# include "envelope.h"
+#endif
+#include "clock_mapping.h"
+#include "lateness.h"
+#include "schedule.h"
+#include "spsc_queue.h"
+#include "standard.h"
 
 namespace clockson {
 
 class Network;
 
+/* Output for each time signal standard, in order of the GPIOs */
+using TransmitSchedule = Schedule<standard::MSF, standard::DCF77,
+	standard::WWVB, standard::JJY>;
+
 class Transmit {
 public:
-	Transmit(Network &network, gpio_num_t pin, bool active_low);
+	/* Outputs that are GPIO_NUM_NC are disabled */
+	using Pins = std::array<gpio_num_t, TransmitSchedule::SIZE>;
+
+	Transmit(Network &network, const Pins &pins, bool active_low);
 	~Transmit() = delete;
 
+	/*
+	 * Time of the last change of the output, which may be in the future if
+	 * it has been scheduled in advance
+	 */
 	inline uint64_t last_us() const { return last_us_; }
 
+	/*
+	 * Time that the first complete time signal started (or will start), or
+	 * 0 if there hasn't been one
+	 */
+	inline uint64_t first_frame_us() const { return first_frame_us_; }
+
+	/*
+	 * Time signals are being transmitted (the outputs aren't parked and the
+	 * next time signal hasn't been missed)
+	 */
+	inline bool transmitting() const { return transmitting_ && !missed_; }
+
+	/* Number of time signals that have been prepared for transmission */
+	inline uint32_t frames() const { return frames_; }
+
+	/* Lateness of output changes compared to when they were scheduled */
+	inline const LatenessHistogram& lateness() const { return lateness_; }
+
 private:
 	static constexpr const char *TAG = "clockson.Transmit";
+	/*
+	 * Number of time signals to prepare in advance. Each one is scheduled
+	 * using the clock mapping from when it was prepared, so preparing more
+	 * than one minute ahead makes the clock correction less accurate.
+	 */
+	static constexpr size_t FRAMES_AHEAD = 1;
+	/*
+	 * Prepared in advance and being transmitted, which is reused for the
+	 * next time signal when it has finished
+	 */
+	static constexpr size_t FRAME_BUFFERS = FRAMES_AHEAD + 1;
+	/* Time before the start of a minute to prepare its time signal */
+	static constexpr uint64_t FRAME_LEAD_US = 10000000;
+	static constexpr uint32_t FRAME_TASK_STACK_SIZE = 4096;
+	static constexpr UBaseType_t FRAME_TASK_PRIORITY = 2;
+	static constexpr BaseType_t FRAME_TASK_CORE = CONFIG_CLOCKSON_NETWORK_CORE;
+	/*
+	 * Time to keep checking for the next time signal to be prepared before
+	 * parking the outputs, because the current one finishes before the end of
+	 * the minute
+	 */
+	static constexpr uint64_t FRAME_WAIT_US = 1000000;
+	static constexpr uint64_t FRAME_RETRY_US = 50000;
+	/* Time between checks for the next time signal while parked */
+	static constexpr uint64_t PARKED_RETRY_US = 1000000;
+	/*
+	 * Time after the first change of a prepared time signal by which the
+	 * transmit path must have started it, otherwise transmission has stopped
+	 */
+	static constexpr uint64_t FRAME_LATE_US = 100000;
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	static constexpr uint32_t GPTIMER_RESOLUTION_HZ = 1000000;
+	static constexpr uint32_t TASK_STACK_SIZE = 4096;
+	static constexpr UBaseType_t TASK_PRIORITY = CONFIG_CLOCKSON_TRANSMIT_PRIORITY;
+	static constexpr BaseType_t TASK_CORE = CONFIG_CLOCKSON_TRANSMIT_CORE;
+#endif
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+	/* Number of time signals to include in each benchmark report */
+	static constexpr uint32_t BENCHMARK_FRAMES = 60;
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_CARRIER
+	/* Carrier frequency of each output, in order of the GPIOs */
+	static constexpr std::array<uint32_t, TransmitSchedule::SIZE> CARRIER_HZ{
+		CONFIG_CLOCKSON_MSF_CARRIER_HZ,
+		CONFIG_CLOCKSON_DCF77_CARRIER_HZ,
+		CONFIG_CLOCKSON_WWVB_CARRIER_HZ,
+		CONFIG_CLOCKSON_JJY_CARRIER_HZ,
+	};
+	static constexpr uint32_t CARRIER_DUTY_PERCENT = CONFIG_CLOCKSON_CARRIER_DUTY_PERCENT;
+# ifndef CONFIG_CLOCKSON_OUTPUT_RMT
+	static constexpr uint32_t LEDC_CLOCK_HZ = 80000000;
+# endif
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	/*
+	 * Time before the first change to start each RMT transmission, so that
+	 * the start can be adjusted for the lateness of the timer. This must be
+	 * less than the shortest time between the last change of one minute and
+	 * the first change of the next (200ms for WWVB) so that the previous
+	 * transmission has finished.
+	 */
+	static constexpr uint64_t RMT_START_LEAD_US = 20000;
+#endif
 
+	static void frame_task(void *arg);
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	static void task(void *arg);
+	static bool alarm(gptimer_handle_t timer,
+		const gptimer_alarm_event_data_t *edata, void *arg);
+#else
 	static void event(void *arg);
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	static bool rmt_done(rmt_channel_handle_t channel,
+		const rmt_tx_done_event_data_t *edata, void *arg);
+#endif
+
+	inline void record_lateness(uint64_t scheduled_us, uint64_t actual_us) {
+		lateness_.record(scheduled_us, actual_us);
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+		benchmark_.record(scheduled_us, actual_us);
+#endif
+	}
 
 	inline int active() const { return active_low_ ? 0 : 1; }
 	inline int inactive() const { return active_low_ ? 1 : 0; }
 
+	/* Time signals for a minute, prepared in advance */
+	struct Frame {
+		TransmitSchedule schedule;
+		/* Number of clock steps when it was prepared */
+		uint32_t steps{0};
+		/* Time of the last change, 0 if there are none */
+		uint64_t end_us{0};
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+		/* Encoded from the schedule, which is then empty */
+		std::array<Envelope, TransmitSchedule::SIZE> envelopes;
+		/* Scheduled start of the transmission, 0 once it has started */
+		uint64_t start_us{0};
+		/* Time of the first change, 0 if the start of the minute is skipped */
+		uint64_t first_us{0};
+#endif
+	};
+
+	[[noreturn]] void frame_task();
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	[[noreturn]] void task();
+	bool alarm();
+#else
 	void event();
+#endif
+	bool prepare(Frame &frame, uint64_t &wait_us);
+	bool next_frame(uint64_t uptime_us, uint64_t &wait_us);
+	void park();
+	void set_transmitting(bool transmitting);
+	void report_first_frame(uint64_t start_us);
+	void report_lateness();
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	void encode_rmt(Frame &frame, uint64_t uptime_us);
+	void start_rmt();
+	void rmt_wait();
+	bool rmt_done(rmt_channel_handle_t channel);
+#endif
+
+	struct Output {
+		gpio_num_t pin{GPIO_NUM_NC};
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+		rmt_channel_handle_t rmt_channel{nullptr};
+		Envelope::symbol_t rmt_park{0};
+		/*
+		 * Time of the last change of the current transmission, which happens
+		 * when it finishes, or 0 if it isn't measured
+		 */
+		uint64_t rmt_end_us{0};
+#elif defined(CONFIG_CLOCKSON_OUTPUT_CARRIER)
+		ledc_channel_t ledc_channel{LEDC_CHANNEL_0};
+		uint32_t duty{0};
+#endif
+	};
+
+	/* Messages that are formatted later, see Network::syslog() */
+	struct FrameMessage {
+		std::array<uint64_t, TransmitSchedule::SIZE> times;
+		ClockMapping clock;
+
+		size_t format(char *text, size_t size) const;
+	};
+
+	struct FirstFrameMessage {
+		uint64_t start_us;
+		uint64_t first_sync_us;
+
+		size_t format(char *text, size_t size) const;
+	};
+
+	struct LatenessMessage {
+		LatenessHistogram::Summary summary;
+
+		size_t format(char *text, size_t size) const;
+	};
+
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+	struct BenchmarkMessage {
+		LatenessHistogram::Summary summary;
+
+		size_t format(char *text, size_t size) const;
+	};
+#endif
+
+	static std::array<bool, TransmitSchedule::SIZE> enabled(const Pins &pins);
+
+	esp_err_t set_carrier(const Output &output, bool carrier);
 
 	Network &network_;
-	const gpio_num_t pin_;
 	const bool active_low_;
+	std::array<Output, TransmitSchedule::SIZE> outputs_;
+	TaskHandle_t frame_task_{nullptr};
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	gptimer_handle_t gptimer_{nullptr};
+	TaskHandle_t task_{nullptr};
+#else
 	esp_timer_handle_t timer_{nullptr};
+#endif
 	uint64_t offset_us_{0};
+
+	/* Only used by the frame task */
+	TransmitSchedule next_;
 	uint64_t last_signal_s_{0};
-	TimeSignal current_;
+	uint32_t last_steps_{0};
+	uint64_t next_prepare_us_{0};
+	Frame *building_{nullptr};
+	/* Time of the last change of the previous time signal */
+	uint64_t prepared_end_us_{0};
+	/* Time that the ready time signal is late, 0 if it's not being checked */
+	uint64_t ready_late_us_{0};
+	bool first_frame_reported_{false};
+
+	/* Only used by the transmit path */
+	Frame *current_{nullptr};
+	uint64_t waiting_us_{0};
+
+	std::array<Frame, FRAME_BUFFERS> frame_buffers_;
+	/* Prepared by the frame task for the transmit path */
+	SpscQueue<Frame*, FRAMES_AHEAD> ready_;
+	/* Returned by the transmit path for the frame task to reuse */
+	SpscQueue<Frame*, std::bit_ceil(FRAME_BUFFERS)> free_;
+
 	std::atomic<uint64_t> last_us_{0};
+	std::atomic<uint64_t> first_frame_us_{0};
+	std::atomic<uint32_t> frames_{0};
+	std::atomic<bool> transmitting_{false};
+	/* The transmit path didn't start the ready time signal in time */
+	std::atomic<bool> missed_{false};
+	LatenessHistogram lateness_;
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+	LatenessHistogram benchmark_;
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	rmt_encoder_handle_t rmt_encoder_{nullptr};
+	/* Starts the channels together when there's more than one output */
+	rmt_sync_manager_handle_t rmt_sync_{nullptr};
+	bool rmt_parked_{false};
+#endif
 };
 
 } // namespace clockson
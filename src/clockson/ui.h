@@ -21,8 +21,10 @@
 #include "freertos.h"
 
 #include <cstddef>
+#include <cstdint>
 
 #include <led_strip.h>
+#include <sdkconfig.h>
 
 namespace clockson {
 
@@ -32,6 +34,8 @@ struct RGBColour {
 	uint8_t red;
 	uint8_t green;
 	uint8_t blue;
+
+	bool operator==(const RGBColour &other) const = default;
 } __attribute__((packed));
 
 namespace colour {
@@ -62,12 +66,20 @@ public:
 
 private:
 	static constexpr uint8_t LED_LEVEL = CONFIG_CLOCKSON_UI_LED_BRIGHTNESS;
+	/* Time since the last sync after which it is shown as out of date */
+	static constexpr uint64_t SYNC_STALE_US = 2 * CONFIG_LWIP_SNTP_UPDATE_DELAY * 1000ULL;
+	/*
+	 * Estimated error of the system clock after which it is shown as close
+	 * to the end of holdover
+	 */
+	static constexpr double HOLDOVER_WARNING_US = CONFIG_CLOCKSON_HOLDOVER_LIMIT_MS * 1000.0 / 2;
 
 	void set_led(ui::RGBColour colour);
 
 	Network &network_;
 	Transmit &transmit_;
 	led_strip_handle_t led_strip_{nullptr};
+	ui::RGBColour led_colour_{ui::colour::OFF};
 };
 
 } // namespace clockson
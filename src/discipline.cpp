@@ -0,0 +1,192 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/discipline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace clockson {
+
+bool ClockDiscipline::sample(uint64_t uptime_us, int64_t offset_us) {
+	/* Error of the clock without any of the adjustments that were applied */
+	const double error_us = offset_us + applied_us_;
+
+	phase_jump_us_ = 0;
+
+	if (samples_ == 0) {
+		phase_us_ = error_us;
+		residual_us_ = 0;
+		last_uptime_us_ = uptime_us;
+		samples_ = 1;
+		outliers_ = 0;
+		return true;
+	}
+
+	if (uptime_us <= last_uptime_us_) {
+		return false;
+	}
+
+	const double interval_us = uptime_us - last_uptime_us_;
+	const double predicted_us = phase_us_ + frequency_ * interval_us;
+	const double residual_us = error_us - predicted_us;
+
+	residual_us_ = residual_us;
+
+	const bool outliers = samples_ >= MIN_SAMPLES_FOR_OUTLIERS;
+	const double outlier_us = std::max(MIN_OUTLIER_US,
+		OUTLIER_DEVIATIONS * std::sqrt(variance_us2_));
+
+	if (outliers && std::abs(residual_us) > outlier_us) {
+		if (outliers_ < MAX_OUTLIERS) {
+			outliers_++;
+			return false;
+		}
+
+		/*
+		 * The outliers have persisted, so the phase has changed (e.g. the
+		 * clock was set by something else). Use the new phase without
+		 * changing the frequency estimate or the variance, which would
+		 * otherwise make the error bound too large to use.
+		 */
+		phase_us_ = error_us;
+		phase_jump_us_ = residual_us;
+		interval_us_ = interval_us;
+		last_uptime_us_ = uptime_us;
+		outliers_ = 0;
+		return true;
+	}
+
+	const double n = ++samples_;
+	const double alpha = std::max(ALPHA_MIN, 2.0 * (2.0 * n - 1.0) / (n * (n + 1.0)));
+	const double beta = std::max(BETA_MIN, 6.0 / (n * (n + 1.0)));
+
+	phase_us_ = predicted_us + alpha * residual_us;
+	frequency_ += beta * residual_us / interval_us;
+	/*
+	 * Once outliers are being ignored, residuals are limited to the outlier
+	 * threshold so that the variance (and the error bound) only grows
+	 * gradually
+	 */
+	variance_us2_ += (std::min(residual_us * residual_us,
+		outliers ? outlier_us * outlier_us : INFINITY) - variance_us2_) / 16.0;
+	interval_us_ = interval_us;
+	last_uptime_us_ = uptime_us;
+	outliers_ = 0;
+
+	/*
+	 * The average lags behind a frequency error that is changing at a
+	 * constant rate by that rate multiplied by the time constant
+	 */
+	if (samples_ == 2) {
+		frequency_average_ = frequency_;
+		drift_ = 0;
+	} else {
+		const double gain = std::min(1.0, interval_us / DRIFT_TIME_CONSTANT_US);
+
+		frequency_average_ += gain * (frequency_ - frequency_average_);
+		drift_ += gain * ((frequency_ - frequency_average_) / DRIFT_TIME_CONSTANT_US - drift_);
+	}
+
+	drift_max_ = std::max(std::abs(drift_),
+		drift_max_ * std::exp(-interval_us / DRIFT_DECAY_US));
+	return true;
+}
+
+void ClockDiscipline::step(uint64_t uptime_us) {
+	phase_us_ = 0;
+	applied_us_ = 0;
+	outliers_ = 0;
+	last_uptime_us_ = uptime_us;
+}
+
+/*
+ * The error of the phase estimate is less than the residuals, which also
+ * include the measurement noise. The frequency estimate has the uncertainty
+ * of a least squares fit of the samples until the gains reach their minimum
+ * values (as an alpha-beta filter in steady state), and it lags behind the
+ * frequency error when that is drifting.
+ */
+ClockDiscipline::Bound ClockDiscipline::bound() const {
+	const double deviation_us = std::sqrt(variance_us2_);
+	const double drift = drift_max_ + DRIFT_MIN;
+
+	if (samples_ < 2) {
+		/* The frequency hasn't been measured */
+		return {last_uptime_us_, BOUND_DEVIATIONS * deviation_us,
+			FREQUENCY_TOLERANCE, drift};
+	}
+
+	static constexpr double STEADY_STATE = BETA_MIN * (2.0 * ALPHA_MIN - BETA_MIN)
+		/ (2.0 * (1.0 - ALPHA_MIN));
+	static constexpr double STEADY_STATE_LAG = (ALPHA_MIN - BETA_MIN / 2.0) / BETA_MIN;
+	const double n = samples_;
+	const double least_squares = 12.0 / (n * (n * n - 1.0));
+
+	return {
+		last_uptime_us_,
+		BOUND_DEVIATIONS * deviation_us,
+		BOUND_DEVIATIONS * deviation_us / interval_us_
+			* std::sqrt(std::max(least_squares, STEADY_STATE))
+			+ drift * interval_us_ * STEADY_STATE_LAG,
+		drift,
+	};
+}
+
+double ClockDiscipline::Bound::error_us(uint64_t now_us) const {
+	const double elapsed_us = now_us > uptime_us ? now_us - uptime_us : 0.0;
+
+	return phase_us + frequency * elapsed_us + 0.5 * drift * elapsed_us * elapsed_us;
+}
+
+double ClockDiscipline::error_bound_us(uint64_t uptime_us) const {
+	return bound().error_us(uptime_us);
+}
+
+uint64_t ClockDiscipline::Bound::limit_uptime_us(double limit_us) const {
+	if (phase_us >= limit_us) {
+		return uptime_us;
+	}
+
+	/* Solve the quadratic for the elapsed time (drift is always positive) */
+	const double elapsed_us = (-frequency + std::sqrt(frequency * frequency
+		+ 2.0 * drift * (limit_us - phase_us))) / drift;
+
+	return uptime_us + (uint64_t)std::min(elapsed_us, 1e18);
+}
+
+uint64_t ClockDiscipline::error_limit_uptime_us(double limit_us) const {
+	return bound().limit_uptime_us(limit_us);
+}
+
+int64_t ClockDiscipline::adjustment(uint64_t uptime_us, int64_t limit_us) {
+	if (samples_ == 0) {
+		return 0;
+	}
+
+	const double elapsed_us = uptime_us > last_uptime_us_
+		? uptime_us - last_uptime_us_ : 0.0;
+	const int64_t target_us = std::llround(phase_us_ + frequency_ * elapsed_us);
+	const int64_t adjust_us = std::clamp(target_us - applied_us_, -limit_us, limit_us);
+
+	applied_us_ += adjust_us;
+	return adjust_us;
+}
+
+} // namespace clockson
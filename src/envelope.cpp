@@ -0,0 +1,121 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/envelope.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "clockson/time_signal.h"
+
+namespace clockson {
+
+bool Envelope::encode(TimeSignal &signal, uint64_t start_us, int active,
+		int inactive) {
+	begin(start_us, active);
+
+	if (!signal.available()) {
+		return false;
+	}
+
+	while (signal.available()) {
+		Signal next = signal.next();
+
+		signal.pop();
+
+		if (!change(next.unsigned_ts(), next.carrier ? active : inactive)) {
+			return false;
+		}
+	}
+
+	return finish();
+}
+
+void Envelope::begin(uint64_t start_us, int level) {
+	size_ = 0;
+	half_ = false;
+	end_us_ = start_us;
+	end_level_ = level;
+}
+
+bool Envelope::change(uint64_t ts_us, int level) {
+	uint64_t next_us = std::max(end_us_, ts_us);
+
+	if (!add(next_us - end_us_, end_level_)) {
+		return false;
+	}
+
+	end_us_ = next_us;
+	end_level_ = level;
+	return true;
+}
+
+bool Envelope::finish() {
+	/*
+	 * A duration of 0 ends the transmission, so the last duration needs to
+	 * be split in two if it would only fill half of a symbol. The level
+	 * after the last change is set when the transmission ends.
+	 */
+	if (half_) {
+		symbol_t &last = symbols_[size_ - 1];
+		uint32_t duration = last & MAX_DURATION;
+		int last_level = (last >> 15) & 1U;
+
+		last = symbol(duration - duration / 2, last_level, duration / 2, last_level);
+		half_ = false;
+	}
+
+	return size_ > 0;
+}
+
+bool Envelope::shift_start(uint64_t late_us) {
+	if (!size_ || !late_us) {
+		return true;
+	}
+
+	/* A duration of 0 ends the transmission, so it can't be removed entirely */
+	symbol_t &first = symbols_[0];
+	uint32_t duration = first & MAX_DURATION;
+	uint32_t shift = std::min(late_us, (uint64_t)duration - 1);
+
+	first = (first & ~(symbol_t)MAX_DURATION) | (duration - shift);
+	return shift == late_us;
+}
+
+bool Envelope::add(uint64_t duration, int level) {
+	while (duration > 0) {
+		uint32_t value = std::min(duration, (uint64_t)MAX_DURATION);
+
+		if (half_) {
+			symbols_[size_ - 1] |= symbol(0, 0, value, level);
+			half_ = false;
+		} else if (size_ < symbols_.size()) {
+			symbols_[size_++] = symbol(value, level, 0, 0);
+			half_ = true;
+		} else {
+			return false;
+		}
+
+		duration -= value;
+	}
+
+	return true;
+}
+
+} // namespace clockson
@@ -0,0 +1,138 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/heap_usage.h"
+
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace clockson {
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+std::array<HeapUsage::Task, HeapUsage::MAX_TASKS> HeapUsage::tasks_;
+HeapUsage::Task HeapUsage::other_;
+uint32_t HeapUsage::reported_allocs_{0};
+
+IRAM_ATTR void HeapUsage::allocated() {
+	current()->allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+IRAM_ATTR void HeapUsage::freed() {
+	current()->frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Find the counters for the current task, adding it if it's new */
+IRAM_ATTR HeapUsage::Task* HeapUsage::current() {
+	TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+
+	if (handle == nullptr) {
+		return &other_;
+	}
+
+	for (auto &task : tasks_) {
+		TaskHandle_t existing = task.handle.load(std::memory_order_acquire);
+
+		if (existing == nullptr
+				&& task.handle.compare_exchange_strong(existing, handle,
+					std::memory_order_acq_rel)) {
+			std::strncpy(task.name.data(), pcTaskGetName(nullptr),
+				task.name.size() - 1);
+			return &task;
+		}
+
+		if (existing == handle) {
+			return &task;
+		}
+	}
+
+	return &other_;
+}
+
+bool HeapUsage::task(size_t index, char *text, size_t size) {
+	Task &task = tasks_[index];
+
+	if (task.handle.load(std::memory_order_acquire) == nullptr) {
+		return false;
+	}
+
+	const uint32_t allocs = task.allocs;
+	const uint32_t frees = task.frees;
+
+	if (allocs == task.reported_allocs && frees == task.reported_frees) {
+		return false;
+	}
+
+	std::snprintf(text, size, "Heap allocations by %s: %" PRIu32 " (+%" PRIu32
+		"), frees: %" PRIu32 " (+%" PRIu32 ")", task.name.data(),
+		allocs, allocs - task.reported_allocs, frees, frees - task.reported_frees);
+	task.reported_allocs = allocs;
+	task.reported_frees = frees;
+	return true;
+}
+#endif
+
+void HeapUsage::summary(char *text, size_t size) {
+	int length = std::snprintf(text, size,
+		"Heap: %zu free, %zu largest free block, %zu minimum free",
+		heap_caps_get_free_size(MALLOC_CAP_8BIT),
+		heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+		heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+	uint32_t allocs = other_.allocs;
+
+	for (const auto &task : tasks_) {
+		allocs += task.allocs;
+	}
+
+	if (length > 0 && (size_t)length < size) {
+		std::snprintf(text + length, size - length,
+			", %" PRIu32 " allocations (+%" PRIu32 ")",
+			allocs, allocs - reported_allocs_);
+	}
+
+	reported_allocs_ = allocs;
+#else
+	(void)length;
+#endif
+}
+
+} // namespace clockson
+
+#ifdef CONFIG_CLOCKSON_HEAP_TRACE
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t,
+		uint32_t) {
+	if (ptr != nullptr) {
+		clockson::HeapUsage::allocated();
+	}
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void *ptr) {
+	if (ptr != nullptr) {
+		clockson::HeapUsage::freed();
+	}
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/lateness.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace clockson {
+
+void LatenessHistogram::record(uint64_t lateness_us) {
+	uint32_t value = std::min(lateness_us, (uint64_t)UINT32_MAX);
+	uint32_t current = min_us_.load(std::memory_order_relaxed);
+
+	while (value < current && !min_us_.compare_exchange_weak(current, value,
+			std::memory_order_relaxed));
+
+	current = max_us_.load(std::memory_order_relaxed);
+
+	while (value > current && !max_us_.compare_exchange_weak(current, value,
+			std::memory_order_relaxed));
+
+	buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+	total_.fetch_add(1, std::memory_order_relaxed);
+}
+
+LatenessHistogram::Summary LatenessHistogram::reset() {
+	std::array<uint32_t, BUCKETS> counts;
+	Summary summary{};
+
+	for (size_t i = 0; i < BUCKETS; i++) {
+		counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+		summary.count += counts[i];
+	}
+
+	summary.min_us = min_us_.exchange(UINT32_MAX, std::memory_order_relaxed);
+	summary.max_us = max_us_.exchange(0, std::memory_order_relaxed);
+
+	if (summary.count == 0) {
+		summary.min_us = 0;
+		save(summary);
+		return summary;
+	}
+
+	/* Percentiles are the upper bound of the bucket that contains them */
+	const uint64_t p50 = ((uint64_t)summary.count * 500 + 999) / 1000;
+	const uint64_t p99 = ((uint64_t)summary.count * 990 + 999) / 1000;
+	const uint64_t p999 = ((uint64_t)summary.count * 999 + 999) / 1000;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < BUCKETS; i++) {
+		uint64_t previous = total;
+
+		total += counts[i];
+
+		if (previous < p50 && total >= p50) {
+			summary.p50_us = std::min(upper_bound(i), summary.max_us);
+		}
+
+		if (previous < p99 && total >= p99) {
+			summary.p99_us = std::min(upper_bound(i), summary.max_us);
+		}
+
+		if (previous < p999 && total >= p999) {
+			summary.p999_us = std::min(upper_bound(i), summary.max_us);
+			break;
+		}
+	}
+
+	save(summary);
+	return summary;
+}
+
+void LatenessHistogram::save(const Summary &summary) {
+	std::array<uint32_t, std::tuple_size_v<decltype(last_)>> values;
+
+	static_assert(sizeof(values) == sizeof(summary));
+	std::memcpy(values.data(), &summary, sizeof(summary));
+
+	for (size_t i = 0; i < values.size(); i++) {
+		last_[i].store(values[i], std::memory_order_relaxed);
+	}
+}
+
+LatenessHistogram::Summary LatenessHistogram::last() const {
+	std::array<uint32_t, std::tuple_size_v<decltype(last_)>> values;
+	Summary summary;
+
+	for (size_t i = 0; i < values.size(); i++) {
+		values[i] = last_[i].load(std::memory_order_relaxed);
+	}
+
+	std::memcpy(&summary, values.data(), sizeof(summary));
+	return summary;
+}
+
+size_t LatenessHistogram::bucket(uint32_t value) {
+	if (value < (1U << LINEAR_BITS)) {
+		return value;
+	}
+
+	const unsigned int exponent = std::bit_width(value) - 1;
+
+	if (exponent > MAX_BITS) {
+		return BUCKETS - 1;
+	}
+
+	const unsigned int shift = exponent - SUB_BUCKET_BITS;
+	const unsigned int sub_bucket = (value >> shift) & ((1U << SUB_BUCKET_BITS) - 1);
+
+	return (1U << LINEAR_BITS) + ((exponent - LINEAR_BITS) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+uint32_t LatenessHistogram::upper_bound(size_t bucket) {
+	if (bucket < (1U << LINEAR_BITS)) {
+		return bucket;
+	}
+
+	bucket -= (1U << LINEAR_BITS);
+
+	const unsigned int exponent = (bucket >> SUB_BUCKET_BITS) + LINEAR_BITS;
+	const unsigned int sub_bucket = bucket & ((1U << SUB_BUCKET_BITS) - 1);
+	const unsigned int shift = exponent - SUB_BUCKET_BITS;
+
+	return ((((1U << SUB_BUCKET_BITS) + sub_bucket + 1) << shift) - 1);
+}
+
+} // namespace clockson
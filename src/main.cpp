@@ -30,7 +30,9 @@
 
 #include <chrono>
 
+#include "clockson/metrics.h"
 #include "clockson/network.h"
+#include "clockson/power_save.h"
 #include "clockson/transmit.h"
 #include "clockson/ui.h"
 
@@ -44,9 +46,17 @@ extern "C" void app_main() {
 	}
 	ESP_ERROR_CHECK(err);
 
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+	PowerSave::init();
+#endif
+
 	Network &network = *new Network{};
-	Transmit &transmit = *new Transmit{network, GPIO_NUM_1, ACTIVE_LOW};
+	Transmit &transmit = *new Transmit{network,
+		{MSF_GPIO, DCF77_GPIO, WWVB_GPIO, JJY_GPIO}, ACTIVE_LOW};
 	UserInterface &ui = *new UserInterface{network, transmit};
+#ifdef CONFIG_CLOCKSON_METRICS
+	new Metrics{network, transmit};
+#endif
 
 	TaskStatus_t status;
 
@@ -0,0 +1,304 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/metrics.h"
+
+#ifdef CONFIG_CLOCKSON_METRICS
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "clockson/lateness.h"
+#include "clockson/network.h"
+#include "clockson/power_save.h"
+#include "clockson/task_usage.h"
+#include "clockson/transmit.h"
+
+namespace clockson {
+
+Metrics::Metrics(Network &network, Transmit &transmit)
+		: network_(network), transmit_(transmit) {
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+	config.server_port = PORT;
+	config.task_priority = TASK_PRIORITY;
+	config.stack_size = TASK_STACK_SIZE;
+	config.core_id = CONFIG_CLOCKSON_NETWORK_CORE;
+	config.max_open_sockets = 2;
+	config.lru_purge_enable = true;
+
+	ESP_ERROR_CHECK(httpd_start(&server_, &config));
+
+	httpd_uri_t uri{};
+
+	uri.uri = "/metrics";
+	uri.method = HTTP_GET;
+	uri.handler = handler;
+	uri.user_ctx = this;
+
+	ESP_ERROR_CHECK(httpd_register_uri_handler(server_, &uri));
+}
+
+esp_err_t Metrics::handler(httpd_req_t *req) {
+	return reinterpret_cast<Metrics*>(req->user_ctx)->handler_metrics(req);
+}
+
+esp_err_t Metrics::handler_metrics(httpd_req_t *req) {
+	req_ = req;
+	err_ = httpd_resp_set_type(req, "text/plain; version=0.0.4");
+	length_ = 0;
+
+	printf("clockson_uptime_seconds %.6f\n", esp_timer_get_time() / 1e6);
+	network_metrics();
+	transmit_metrics();
+	heap_metrics();
+	task_metrics();
+	flush();
+
+	if (err_ == ESP_OK) {
+		err_ = httpd_resp_send_chunk(req, nullptr, 0);
+	}
+
+	req_ = nullptr;
+	return err_;
+}
+
+void Metrics::network_metrics() {
+	const auto &stats = Network::time_stats();
+	uint64_t now_us = esp_timer_get_time();
+	uint64_t time_sync_us{0};
+	bool time_ok = Network::time_ok(&time_sync_us);
+
+	metric("clockson_time_ok", "gauge", "System clock is synced");
+	printf("clockson_time_ok %d\n", time_ok ? 1 : 0);
+
+	if (time_sync_us) {
+		metric("clockson_time_sync_age_seconds", "gauge", "Time since the last NTP sync");
+		printf("clockson_time_sync_age_seconds %.6f\n",
+			(now_us - std::min(now_us, time_sync_us)) / 1e6);
+
+		uint64_t valid_until_us = Network::time_valid_until_us();
+
+		metric("clockson_time_error_bound_seconds", "gauge", "Estimated maximum error of the system clock");
+		printf("clockson_time_error_bound_seconds %.6f\n", Network::time_error_bound_us() / 1e6);
+
+		metric("clockson_time_holdover_remaining_seconds", "gauge", "Time until the estimated error exceeds the holdover limit");
+		printf("clockson_time_holdover_remaining_seconds %.6f\n",
+			(valid_until_us - std::min(now_us, valid_until_us)) / 1e6);
+	}
+
+	metric("clockson_time_error_limit_seconds", "gauge", "Holdover limit for the estimated error of the system clock");
+	printf("clockson_time_error_limit_seconds %.6f\n", Network::TIME_ERROR_LIMIT_US / 1e6);
+
+	metric("clockson_time_steps_total", "counter", "System clock steps");
+	printf("clockson_time_steps_total %" PRIu32 "\n", stats.steps.load());
+
+	metric("clockson_time_slews_total", "counter", "System clock slews applied between transmissions");
+	printf("clockson_time_slews_total %" PRIu32 "\n", stats.slews.load());
+
+	metric("clockson_time_slew_seconds_total", "counter", "Total size of system clock slews");
+	printf("clockson_time_slew_seconds_total %.6f\n", stats.slewed_us.load() / 1e6);
+
+	metric("clockson_time_last_slew_seconds", "gauge", "Size of the last system clock slew");
+	printf("clockson_time_last_slew_seconds %.6f\n", stats.last_slew_us.load() / 1e6);
+
+	metric("clockson_time_adjust_failures_total", "counter", "System clock adjustments that failed");
+	printf("clockson_time_adjust_failures_total %" PRIu32 "\n", stats.failures.load());
+
+	metric("clockson_time_offsets_total", "counter", "NTP offsets sampled by the clock discipline");
+	printf("clockson_time_offsets_total{result=\"used\"} %" PRIu32 "\n", stats.offsets_used.load());
+	printf("clockson_time_offsets_total{result=\"ignored\"} %" PRIu32 "\n", stats.offsets_ignored.load());
+
+	metric("clockson_time_last_offset_seconds", "gauge", "Last NTP offset of the system clock");
+	printf("clockson_time_last_offset_seconds %.6f\n", stats.last_offset_us.load() / 1e6);
+
+	metric("clockson_time_frequency_ppm", "gauge", "Estimated frequency error of the system clock");
+	printf("clockson_time_frequency_ppm %.3f\n", stats.frequency_ppb.load() / 1e3);
+
+	metric("clockson_time_drift_ppm_per_hour", "gauge", "Estimated maximum rate of change of the frequency error");
+	printf("clockson_time_drift_ppm_per_hour %.3f\n", stats.drift_ppb_per_hour.load() / 1e3);
+
+	metric("clockson_syslog_dropped_total", "counter", "Log messages dropped because the queue was full");
+	printf("clockson_syslog_dropped_total %" PRIu32 "\n", network_.syslog_dropped());
+
+	metric("clockson_syslog_errors_total", "counter", "Log messages that couldn't be sent to syslog");
+	printf("clockson_syslog_errors_total %" PRIu32 "\n", network_.syslog_errors());
+}
+
+void Metrics::transmit_metrics() {
+	const LatenessHistogram &lateness = transmit_.lateness();
+	const LatenessHistogram::Summary summary = lateness.last();
+	int64_t now_us = esp_timer_get_time();
+	uint64_t last_us = transmit_.last_us();
+	uint64_t first_frame_us = transmit_.first_frame_us();
+
+	metric("clockson_transmit_frames_total", "counter", "Time signals prepared for transmission");
+	printf("clockson_transmit_frames_total %" PRIu32 "\n", transmit_.frames());
+
+	if (last_us) {
+		metric("clockson_transmit_last_change_age_seconds", "gauge",
+			"Time since the last output change (negative if it is scheduled)");
+		printf("clockson_transmit_last_change_age_seconds %.6f\n",
+			(now_us - (int64_t)last_us) / 1e6);
+	}
+
+	if (first_frame_us) {
+		metric("clockson_transmit_first_frame_seconds", "gauge",
+			"Uptime when the first complete time signal started");
+		printf("clockson_transmit_first_frame_seconds %.6f\n", first_frame_us / 1e6);
+	}
+
+	metric("clockson_transmit_changes_total", "counter", "Output changes");
+	printf("clockson_transmit_changes_total %" PRIu32 "\n", lateness.total());
+
+	metric("clockson_transmit_lateness_seconds", "summary",
+		"Lateness of output changes during the last time signal");
+	printf("clockson_transmit_lateness_seconds{quantile=\"0\"} %.6f\n", summary.min_us / 1e6);
+	printf("clockson_transmit_lateness_seconds{quantile=\"0.5\"} %.6f\n", summary.p50_us / 1e6);
+	printf("clockson_transmit_lateness_seconds{quantile=\"0.99\"} %.6f\n", summary.p99_us / 1e6);
+	printf("clockson_transmit_lateness_seconds{quantile=\"0.999\"} %.6f\n", summary.p999_us / 1e6);
+	printf("clockson_transmit_lateness_seconds{quantile=\"1\"} %.6f\n", summary.max_us / 1e6);
+	printf("clockson_transmit_lateness_seconds_count %" PRIu32 "\n", summary.count);
+
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+	const PowerSave::Totals power = PowerSave::totals();
+
+	metric("clockson_power_sleep_seconds_total", "counter", "Time spent in light sleep");
+	printf("clockson_power_sleep_seconds_total %.6f\n", power.sleep_us / 1e6);
+
+	metric("clockson_power_sleeps_total", "counter", "Light sleeps");
+	printf("clockson_power_sleeps_total %" PRIu32 "\n", power.sleeps);
+
+	metric("clockson_power_wakes_total", "counter", "Wake ups before output changes");
+	printf("clockson_power_wakes_total %" PRIu32 "\n", power.wakes);
+
+	metric("clockson_power_late_wakes_total", "counter", "Wake ups that were later than the margin");
+	printf("clockson_power_late_wakes_total %" PRIu32 "\n", power.late_wakes);
+
+	metric("clockson_power_wake_margin_seconds", "gauge", "Time to wake up before output changes");
+	printf("clockson_power_wake_margin_seconds %.6f\n", power.margin_us / 1e6);
+#endif
+}
+
+void Metrics::heap_metrics() {
+	static constexpr std::pair<const char *, uint32_t> HEAPS[] = {
+		{"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+#ifdef CONFIG_SPIRAM
+		{"psram", MALLOC_CAP_SPIRAM},
+#endif
+	};
+
+	metric("clockson_heap_size_bytes", "gauge", "Total heap size");
+	for (const auto &[name, caps] : HEAPS) {
+		printf("clockson_heap_size_bytes{memory=\"%s\"} %zu\n",
+			name, heap_caps_get_total_size(caps));
+	}
+
+	metric("clockson_heap_free_bytes", "gauge", "Free heap");
+	for (const auto &[name, caps] : HEAPS) {
+		printf("clockson_heap_free_bytes{memory=\"%s\"} %zu\n",
+			name, heap_caps_get_free_size(caps));
+	}
+
+	metric("clockson_heap_minimum_free_bytes", "gauge", "Minimum free heap since boot");
+	for (const auto &[name, caps] : HEAPS) {
+		printf("clockson_heap_minimum_free_bytes{memory=\"%s\"} %zu\n",
+			name, heap_caps_get_minimum_free_size(caps));
+	}
+
+	metric("clockson_heap_largest_free_block_bytes", "gauge", "Largest free heap block");
+	for (const auto &[name, caps] : HEAPS) {
+		printf("clockson_heap_largest_free_block_bytes{memory=\"%s\"} %zu\n",
+			name, heap_caps_get_largest_free_block(caps));
+	}
+}
+
+void Metrics::task_metrics() {
+	if (!TaskUsage::update()) {
+		ESP_LOGW(TAG, "Too many tasks (%u)", (unsigned int)uxTaskGetNumberOfTasks());
+		return;
+	}
+
+	metric("clockson_task_cpu_seconds_total", "counter", "CPU time used by each task");
+	TaskUsage::totals([this] (const char *name, int core, uint64_t total_us,
+			UBaseType_t) {
+		if (core >= 0) {
+			printf("clockson_task_cpu_seconds_total{task=\"%s\",core=\"%d\"} %.6f\n",
+				name, core, total_us / 1e6);
+		} else {
+			printf("clockson_task_cpu_seconds_total{task=\"%s\",core=\"any\"} %.6f\n",
+				name, total_us / 1e6);
+		}
+	});
+
+	metric("clockson_task_stack_free_bytes", "gauge", "Minimum free stack space of each task");
+	TaskUsage::totals([this] (const char *name, int, uint64_t,
+			UBaseType_t stack_free) {
+		printf("clockson_task_stack_free_bytes{task=\"%s\"} %u\n",
+			name, (unsigned int)stack_free);
+	});
+}
+
+void Metrics::metric(const char *name, const char *type, const char *help) {
+	printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void Metrics::printf(const char *format, ...) {
+	for (int attempt = 0; attempt < 2; attempt++) {
+		va_list ap;
+
+		va_start(ap, format);
+		int length = std::vsnprintf(buffer_.data() + length_,
+			buffer_.size() - length_, format, ap);
+		va_end(ap);
+
+		if (length < 0) {
+			return;
+		}
+
+		if (length_ + length < buffer_.size()) {
+			length_ += length;
+			return;
+		}
+
+		/* Send what's already in the buffer and try again */
+		flush();
+	}
+}
+
+void Metrics::flush() {
+	if (length_ > 0 && err_ == ESP_OK) {
+		err_ = httpd_resp_send_chunk(req_, buffer_.data(), length_);
+	}
+
+	length_ = 0;
+}
+
+} // namespace clockson
+
+#endif
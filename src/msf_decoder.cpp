@@ -0,0 +1,225 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/msf_decoder.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include "clockson/calendar.h"
+#include "clockson/civil.h"
+
+namespace clockson {
+
+namespace {
+
+/* Reverse the order of the bits so that fields can be read MSB first */
+static constexpr uint64_t reverse(uint64_t value) {
+	value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+	value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+	value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	value = ((value >> 8) & 0x00FF00FF00FF00FFULL) | ((value & 0x00FF00FF00FF00FFULL) << 8);
+	value = ((value >> 16) & 0x0000FFFF0000FFFFULL) | ((value & 0x0000FFFF0000FFFFULL) << 16);
+	return (value >> 32) | (value << 32);
+}
+
+static constexpr uint64_t mask(size_t begin, size_t end) {
+	return ((2ULL << end) - 1) & ~((1ULL << begin) - 1);
+}
+
+/* Read BCD digits from a reversed frame, returns false if they're invalid */
+static constexpr bool get_bcd(uint64_t reversed, size_t begin, size_t end,
+		unsigned int &value) {
+	const unsigned int raw = (reversed >> (63 - end)) & ((1U << (end - begin + 1)) - 1);
+	const unsigned int tens = raw >> 4;
+	const unsigned int ones = raw & 0xFU;
+
+	value = tens * 10U + ones;
+	return tens <= 9 && ones <= 9;
+}
+
+/* The number of set bits including the parity bit must be odd */
+static constexpr bool odd_parity_ok(uint64_t data, size_t begin, size_t end,
+		bool parity) {
+	return (std::popcount(data & mask(begin, end)) + parity) % 2 == 1;
+}
+
+static_assert(reverse(1) == 1ULL << 63);
+static_assert(mask(17, 24) == 0x1FE0000);
+
+} // namespace
+
+MsfDecoder::MsfDecoder(unsigned int base_year, int64_t tolerance_us)
+		: base_year_(base_year), tolerance_us_(tolerance_us) {
+}
+
+/*
+ * Decode the second that has just ended, returns true if it was the minute
+ * marker that completes the previous minute
+ */
+bool MsfDecoder::end_second(int64_t length_us) {
+	const uint8_t symbol = SYMBOLS[steps_];
+	int64_t length_s = 1;
+	int64_t length_error_us = std::abs(length_us - ONE_SECOND_US);
+	bool complete = false;
+
+	if (length_error_us >= ONE_SECOND_US / 2) [[unlikely]] {
+		/* More than 1 if the start of following seconds are missing */
+		length_s = (length_us + ONE_SECOND_US / 2) / ONE_SECOND_US;
+		length_error_us = std::abs(length_us - length_s * ONE_SECOND_US);
+	}
+
+	if (symbol == MARKER) {
+		if (in_minute_) {
+			finish_minute();
+			complete = true;
+		}
+
+		in_minute_ = true;
+		minute_us_ = second_us_;
+		seconds_ = 0;
+		errors_ = NONE;
+		max_error_us_ = 0;
+		a_ = 0;
+		b_ = 0;
+	} else if (in_minute_) {
+		seconds_++;
+
+		if (symbol == INVALID) {
+			errors_ |= SYMBOL;
+		} else if (seconds_ <= SECONDS) {
+			a_ |= (uint64_t)(symbol & A) << seconds_;
+			b_ |= (uint64_t)((symbol & B) >> 1) << seconds_;
+		}
+	} else {
+		return false;
+	}
+
+	if (length_s != 1) [[unlikely]] {
+		/* Seconds without a start are missing */
+		errors_ |= SYMBOL;
+		seconds_ += std::max<int64_t>(length_s - 1, 0);
+	}
+
+	/* Changes further than the tolerance are flagged for the whole minute */
+	max_error_us_ = std::max({max_error_us_, length_error_us, second_error_us_});
+
+	if (seconds_ > MAX_SECONDS) {
+		/* Wait for the next minute marker */
+		in_minute_ = false;
+	}
+
+	return complete;
+}
+
+void MsfDecoder::finish_minute() {
+	minute_.start_us = minute_us_;
+	minute_.frame = Frame{standard::data_t{a_}, standard::data_t{b_}};
+	minute_.seconds = seconds_;
+	minute_.errors = errors_ | decode(minute_.frame, base_year_, minute_.utc_time)
+		| (max_error_us_ > tolerance_us_ ? PULSE_WIDTH : NONE);
+	minute_.max_error_us = std::min<int64_t>(max_error_us_, UINT32_MAX);
+
+	if (seconds_ != SECONDS) {
+		minute_.errors |= LENGTH;
+	}
+
+	if (minute_.errors != NONE) {
+		minute_.utc_time = 0;
+	}
+}
+
+uint16_t MsfDecoder::decode(const Frame &frame, unsigned int base_year,
+		uint64_t &utc_time) {
+	const uint64_t a = frame.a.to_ullong();
+	const uint64_t b = frame.b.to_ullong();
+	const uint64_t reversed = reverse(a);
+	uint16_t errors = NONE;
+
+	utc_time = 0;
+
+	if ((a & mask(52, 59)) != mask(53, 58)) {
+		errors |= IDENTIFIER;
+	}
+
+	if (!odd_parity_ok(a, 17, 24, b & (1ULL << 54))
+			|| !odd_parity_ok(a, 25, 35, b & (1ULL << 55))
+			|| !odd_parity_ok(a, 36, 38, b & (1ULL << 56))
+			|| !odd_parity_ok(a, 39, 51, b & (1ULL << 57))) {
+		errors |= PARITY;
+	}
+
+	unsigned int year, month, day, weekday, hour, minute;
+
+	if (!get_bcd(reversed, 17, 24, year)
+			|| !get_bcd(reversed, 25, 29, month)
+			|| !get_bcd(reversed, 30, 35, day)
+			|| !get_bcd(reversed, 36, 38, weekday)
+			|| !get_bcd(reversed, 39, 44, hour)
+			|| !get_bcd(reversed, 45, 51, minute)) {
+		return errors | BCD;
+	}
+
+	year = base_year + (year + 100U - base_year % 100U) % 100U;
+
+	const bool summer = b & (1ULL << 58);
+	const bool summer_change_soon = b & (1ULL << 53);
+	const uint64_t offset_s = zone::UK::OFFSET_S + (summer ? civil::SECONDS_PER_HOUR : 0);
+
+	if (month < 1 || month > 12 || day < 1
+			|| day > civil::days_in_month(year, month)
+			|| hour > 23 || minute > 59 || year < 1970) {
+		return errors | CALENDAR;
+	}
+
+	const uint64_t days = civil::to_days(year, month, day);
+	const uint64_t local_s = days * civil::SECONDS_PER_DAY
+		+ hour * civil::SECONDS_PER_HOUR + minute * civil::SECONDS_PER_MINUTE;
+
+	if (local_s < offset_s) {
+		return errors | CALENDAR;
+	}
+
+	/*
+	 * Check the weekday and summer time bits with the same rules as
+	 * Calendar, without constructing one. Summer time never changes close
+	 * to the end of the year so the local year can be used for it.
+	 */
+	const uint64_t utc_s = local_s - offset_s;
+	const uint64_t next_s = utc_s + zone::UK::SUMMER_WARNING_S;
+	const uint64_t begin_s = civil::summer_begin(year);
+	const uint64_t end_s = civil::summer_end(year);
+
+	if (civil::weekday(days) != weekday
+			|| (utc_s >= begin_s && utc_s < end_s) != summer
+			|| ((next_s >= begin_s && next_s < end_s) != summer) != summer_change_soon) {
+		return errors | CALENDAR;
+	}
+
+	if (errors == NONE) {
+		utc_time = utc_s;
+	}
+
+	return errors;
+}
+
+} // namespace clockson
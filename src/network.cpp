@@ -24,29 +24,25 @@
 #include <esp_sntp.h>
 #include <esp_timer.h>
 #include <esp_wifi.h>
+#include <freertos/task.h>
 #include <netdb.h>
-#include <sys/time.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
-#include <algorithm>
-#include <atomic>
-#include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
-#include <chrono>
-#include <vector>
+#include <algorithm>
+#include <array>
 
-using namespace std::chrono_literals;
-using std::chrono::microseconds;
+#include "clockson/heap_usage.h"
+#include "clockson/ntp.h"
+#include "clockson/power_save.h"
+#include "clockson/task_usage.h"
 
 namespace clockson {
 
-uint64_t Network::time_sync_us_{0};
-bool Network::time_step_first_{true};
-std::atomic<int> Network::time_slew_allowed_{0};
-int Network::time_slew_current_{0};
-
 Network::Network() {
 	ESP_ERROR_CHECK(esp_netif_init());
 	ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -98,15 +94,19 @@ Network::Network() {
 	ESP_ERROR_CHECK(esp_wifi_set_country_code("GB", true));
 
 
+	/*
+	 * SNTP isn't started, it's only used for the list of NTP servers from
+	 * DHCP. All of the servers are polled by the NTP client.
+	 */
 	esp_sntp_config_t sntp_cfg{};
 
-	sntp_cfg.smooth_sync = true;
 	sntp_cfg.server_from_dhcp = true;
-	sntp_cfg.start = true;
-	sntp_cfg.sync_cb = &network::time_synced;
 
 	ESP_ERROR_CHECK(esp_netif_sntp_init(&sntp_cfg));
-
+	ESP_ERROR_CHECK(xTaskCreatePinnedToCore(ntp_task, "ntp", NTP_TASK_STACK_SIZE,
+		this, NTP_TASK_PRIORITY, &ntp_task_, TASK_CORE) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+	ESP_ERROR_CHECK(xTaskCreatePinnedToCore(syslog_task, "syslog", SYSLOG_TASK_STACK_SIZE,
+		this, SYSLOG_TASK_PRIORITY, nullptr, TASK_CORE) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
 
 	wifi_config_t wifi_cfg{};
 
@@ -163,116 +163,188 @@ void Network::event_handler(esp_event_base_t event_base, int32_t event_id,
 	} else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
 		ip_event_got_ip_t* event = reinterpret_cast<ip_event_got_ip_t*>(event_data);
 		ESP_LOGI(TAG, "WiFi IPv4 address: " IPSTR, IP2STR(&event->ip_info.ip));
-		sntp_restart();
+		xTaskNotifyGive(ntp_task_);
 	}
 }
 
-namespace network {
-
-void time_synced(struct timeval *tv) {
-	Network::time_synced(tv);
+void Network::ntp_task(void *arg) {
+	reinterpret_cast<Network*>(arg)->ntp_task();
 }
 
-} // namespace network
-
-void Network::time_synced(struct timeval *tv) {
-	time_sync_us_ = esp_timer_get_time();
-	ESP_LOGI(TAG, "SNTP sync: %llu.%06lu", (unsigned long long)tv->tv_sec,
-		(unsigned long)tv->tv_usec);
-}
-
-bool Network::time_ok() {
-	return time_ok(nullptr);
-}
+/*
+ * Poll all of the NTP servers at the same time every interval, or as soon as
+ * there's a new IP address. The servers are polled in a burst until the time
+ * is synced.
+ */
+void Network::ntp_task() {
+	bool burst = true;
 
-bool Network::time_ok(uint64_t *time_sync_us_out) {
-	uint64_t now = esp_timer_get_time();
-	uint64_t time_sync_us = time_sync_us_;
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(burst
+			? NTP_BURST_RETRY_MS : NTP_POLL_INTERVAL_MS));
 
-	if (time_sync_us_out) {
-		*time_sync_us_out = time_sync_us;
-	}
+		burst = !time_ok();
+		ntp_servers();
 
-	return time_sync_us > 0
-		&& (now - time_sync_us < (uint64_t)microseconds(3h).count());
-}
+		unsigned int polls = 0;
 
-void Network::time_slew_next() {
-	time_slew_allowed_++;
-}
+		for (unsigned int i = 0; i < (burst ? NTP_BURST_POLLS : 1U); i++) {
+			if (i > 0) {
+				vTaskDelay(pdMS_TO_TICKS(NTP_BURST_INTERVAL_MS));
+			}
 
-int Network::adjtime(const struct timeval *delta, struct timeval *outdelta) {
-	if (delta != nullptr) {
-		bool allowed = false;
-		bool applied = false;
-		int time_slew_copy = time_slew_allowed_;
+			if (ntp_.poll(NTP_TIMEOUT_MS)) {
+				polls++;
+			} else {
+				ESP_LOGD(TAG, "NTP poll discarded because the clock was adjusted");
+			}
+		}
 
-		if (time_slew_copy != time_slew_current_) {
-			time_slew_current_ = time_slew_copy;
-			allowed = true;
+		if (!polls) {
+			continue;
 		}
 
-		if (delta->tv_sec != 0 || delta->tv_usec < LOWER_TIME_STEP_US
-				|| delta->tv_usec >= UPPER_TIME_STEP_US || time_step_first_) {
-			/* Outside permitted adjustment range */
-			time_step_first_ = false;
-			errno = EINVAL;
-			return -1;
-		} else if (delta->tv_usec != 0 && allowed) {
-			struct timeval now{};
-
-			if (::gettimeofday(&now, nullptr)) {
-				return -1;
+		NtpSelection selection = ntp_.select();
+
+		for (size_t i = 0; i < NtpClient::MAX_SERVERS; i++) {
+			if (!ntp_.configured(i)) {
+				continue;
 			}
 
-			/*
-			 * Limit maximum slew amount per transmission, which relies on the
-			 * next time sync to continue the adjustment
-			 */
-			if (delta->tv_usec < 0) {
-				now.tv_usec += std::max(delta->tv_usec, LOWER_TIME_SLEW_US);
+			const NtpServer &server = ntp_.server(i);
+			const struct sockaddr_in &addr = ntp_.address(i);
+			const char *state = "unused";
 
-				if (now.tv_usec < 0) {
-					now.tv_sec--;
-					now.tv_usec += ONE_SECOND_US;
-				}
-			} else if (delta->tv_usec > 0) {
-				now.tv_usec += std::min(delta->tv_usec, UPPER_TIME_SLEW_US);
+			switch (server.state()) {
+			case NtpServer::State::NONE:
+				break;
 
-				if (now.tv_usec >= ONE_SECOND_US) {
-					now.tv_sec++;
-					now.tv_usec -= ONE_SECOND_US;
-				}
-			}
+			case NtpServer::State::FALSETICKER:
+				state = "falseticker";
+				break;
+
+			case NtpServer::State::OUTLIER:
+				state = "outlier";
+				break;
 
-			if (::settimeofday(&now, nullptr)) {
-				return -1;
+			case NtpServer::State::SURVIVOR:
+				state = "survivor";
+				break;
 			}
 
-			applied = true;
+			ESP_LOGD(TAG, "NTP server " IPSTR ": reach %03o offset %" PRId64
+				"us delay %" PRId64 "us jitter %.0fus (%s)",
+				IP2STR(reinterpret_cast<const esp_ip4_addr_t*>(&addr.sin_addr)),
+				server.reach(), server.valid() ? server.best().offset_us
+					- time_applied_us() : 0, server.best().delay_us,
+				server.jitter_us(), state);
 		}
 
-		ESP_LOGI(TAG, "SNTP adjtime: tv_sec=%lld tv_usec=%ld (%s)",
-			(unsigned long long)delta->tv_sec, (unsigned long)delta->tv_usec,
-			applied ? "applied" : "skipped");
+		if (!selection.valid) {
+			if (selection.candidates) {
+				ESP_LOGW(TAG, "NTP: no majority of %u servers agree",
+					selection.candidates);
+			}
+			continue;
+		}
+
+		ESP_LOGI(TAG, "NTP: offset %+" PRId64 "us jitter %.0fus"
+			" (%u/%u servers, %u falsetickers%s)",
+			selection.offset_us, selection.jitter_us, selection.survivors,
+			selection.candidates, selection.falsetickers,
+			burst ? ", burst" : "");
+		time_offset(selection.offset_us);
 	}
+}
 
-	if (outdelta) {
-		outdelta->tv_sec = 0;
-		outdelta->tv_usec = 0;
+/* Use the (IPv4) NTP servers from DHCP */
+void Network::ntp_servers() {
+	const size_t count = std::min((size_t)CONFIG_LWIP_SNTP_MAX_SERVERS,
+		NtpClient::MAX_SERVERS);
+
+	for (size_t i = 0; i < NtpClient::MAX_SERVERS; i++) {
+		const ip_addr_t *addr = i < count ? esp_sntp_getserver(i) : nullptr;
+
+		if (addr != nullptr && IP_IS_V4(addr) && !ip_addr_isany(addr)) {
+			struct sockaddr_in sin{};
+
+			sin.sin_family = AF_INET;
+			sin.sin_port = htons(NtpClient::PORT);
+			sin.sin_addr.s_addr = ip_2_ip4(addr)->addr;
+			ntp_.server(i, &sin);
+		} else {
+			ntp_.server(i, nullptr);
+		}
 	}
+}
 
-	return 0;
+void Network::syslog_task(void *arg) {
+	reinterpret_cast<Network*>(arg)->syslog_task();
 }
 
-void Network::syslog(std::string_view message) {
+/*
+ * Format and log all of the queued messages periodically, so that the
+ * messages are sent in batches instead of waking up for every message.
+ */
+void Network::syslog_task() {
+	std::array<char, SYSLOG_MAX_LENGTH> text;
+	uint32_t reported_dropped = 0;
+	uint64_t report_us = 0;
+
+	while (true) {
+		vTaskDelay(pdMS_TO_TICKS(SYSLOG_INTERVAL_MS));
+
+		SyslogRecord record;
+
+		while (syslog_queue_.pop(record)) {
+			record.format(record.data.data(), text.data(), text.size());
+			ESP_LOG_LEVEL(record.level, record.tag, "%s", text.data());
+			syslog_send(record.level, record.uptime_us, text.data());
+		}
+
+		uint32_t dropped = syslog_dropped_;
+
+		if (dropped != reported_dropped) {
+			std::snprintf(text.data(), text.size(),
+				"Syslog queue full: %" PRIu32 " messages dropped (%" PRIu32 " total)",
+				dropped - reported_dropped, dropped);
+			ESP_LOGW(TAG, "%s", text.data());
+			syslog_send(ESP_LOG_WARN, esp_timer_get_time(), text.data());
+			reported_dropped = dropped;
+		}
+
+		uint64_t now_us = esp_timer_get_time();
+
+		if (now_us >= report_us) {
+			auto log = [this, now_us] (const char *line) {
+				ESP_LOGI(TAG, "%s", line);
+				syslog_send(ESP_LOG_INFO, now_us, line);
+			};
+
+			HeapUsage::report(log);
+
+			if (TaskUsage::update()) {
+				TaskUsage::report(log);
+			}
+
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+			PowerSave::report(log);
+#endif
+
+			report_us = now_us + REPORT_INTERVAL_US;
+		}
+	}
+}
+
+void Network::syslog_send(esp_log_level_t level, uint64_t uptime_us,
+		const char *text) {
 	if (syslog_ == -1) {
 		return;
 	}
 
-	std::vector<char> buffer(64 + message.length());
+	std::array<char, 64 + SYSLOG_MAX_LENGTH> buffer;
 
-	uint64_t timestamp_ms = esp_timer_get_time() / 1000U;
+	uint64_t timestamp_ms = uptime_us / 1000U;
 	unsigned long days;
 	unsigned int hours, minutes, seconds, milliseconds;
 
@@ -290,19 +362,39 @@ void Network::syslog(std::string_view message) {
 
 	milliseconds = timestamp_ms;
 
-	std::snprintf(buffer.data(), buffer.size(),
-		"<14>1 - - - - - - \xEF\xBB\xBF%03lu+%02u:%02u:%02u.%03u %*s",
-			days, hours, minutes, seconds, milliseconds,
-			message.length(), message.data());
+	/* Facility user, with the severity from the log level */
+	unsigned int severity = 6;
 
-	::send(syslog_, buffer.data(), std::strlen(buffer.data()), 0);
-}
+	switch (level) {
+	case ESP_LOG_ERROR:
+		severity = 3;
+		break;
 
-} // namespace clockson
+	case ESP_LOG_WARN:
+		severity = 4;
+		break;
+
+	case ESP_LOG_DEBUG:
+	case ESP_LOG_VERBOSE:
+		severity = 7;
+		break;
 
-extern "C" int __real_adjtime();
+	default:
+		break;
+	}
+
+	int length = std::snprintf(buffer.data(), buffer.size(),
+		"<%u>1 - - - - - - \xEF\xBB\xBF%03lu+%02u:%02u:%02u.%03u %s",
+			8 + severity, days, hours, minutes, seconds, milliseconds, text);
+
+	if (length <= 0) {
+		return;
+	}
 
-extern "C" int __wrap_adjtime(const struct timeval *delta,
-		struct timeval *outdelta) {
-	return clockson::Network::adjtime(delta, outdelta);
+	if (::send(syslog_, buffer.data(), std::min((size_t)length,
+			buffer.size() - 1), 0) == -1) {
+		syslog_errors_.fetch_add(1, std::memory_order_relaxed);
+	}
 }
+
+} // namespace clockson
@@ -0,0 +1,234 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/network.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+#include "clockson/clock_mapping.h"
+#include "clockson/discipline.h"
+#include "clockson/status.h"
+
+namespace clockson {
+
+uint64_t Network::time_sync_us_{0};
+uint64_t Network::time_first_sync_us_{0};
+std::atomic<uint64_t> Network::time_valid_until_us_{0};
+std::mutex Network::time_mutex_;
+bool Network::time_step_first_{true};
+ClockDiscipline Network::time_discipline_;
+int64_t Network::time_applied_us_{0};
+Network::TimeStats Network::time_stats_;
+std::array<ClockDiscipline::Bound, 2> Network::time_bound_{{
+	{0, INFINITY, 0, 0},
+	{0, INFINITY, 0, 0},
+}};
+std::atomic<uint32_t> Network::time_bound_seq_{0};
+
+uint64_t Network::wall_us() {
+	struct timeval now{};
+
+	::gettimeofday(&now, nullptr);
+	return now.tv_sec * (uint64_t)ONE_SECOND_US + now.tv_usec;
+}
+
+uint64_t Network::uptime_us() {
+	return esp_timer_get_time();
+}
+
+int64_t Network::time_applied_us() {
+	std::lock_guard lock{time_mutex_};
+
+	return time_applied_us_;
+}
+
+uint64_t Network::time_first_sync_us() {
+	std::lock_guard lock{time_mutex_};
+
+	return time_first_sync_us_;
+}
+
+bool Network::time_ok() {
+	return time_ok(nullptr);
+}
+
+bool Network::time_ok(uint64_t *time_sync_us_out) {
+	uint64_t now = esp_timer_get_time();
+	uint64_t time_sync_us = time_sync_us_;
+
+	if (time_sync_us_out) {
+		*time_sync_us_out = time_sync_us;
+	}
+
+	return time_sync_us > 0 && now < time_valid_until_us();
+}
+
+double Network::time_error_bound_us() {
+	return time_bound().error_us(esp_timer_get_time());
+}
+
+uint64_t Network::time_error_limit_uptime_us(double limit_us) {
+	return time_bound().limit_uptime_us(limit_us);
+}
+
+/*
+ * The current slot is only written after two more syncs, so the copy is
+ * consistent unless the sequence number has changed while reading it
+ */
+ClockDiscipline::Bound Network::time_bound() {
+	while (true) {
+		const uint32_t seq = time_bound_seq_.load(std::memory_order_acquire);
+		const ClockDiscipline::Bound bound = time_bound_[seq & 1U];
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (time_bound_seq_.load(std::memory_order_relaxed) == seq) {
+			return bound;
+		}
+	}
+}
+
+void Network::time_slew_next() {
+	std::lock_guard lock{time_mutex_};
+	int64_t adjust_us = time_discipline_.adjustment(esp_timer_get_time(),
+		UPPER_TIME_SLEW_US);
+
+	if (adjust_us == 0) {
+		return;
+	}
+
+	if (time_adjust(adjust_us)) {
+		time_stats_.slews.fetch_add(1, std::memory_order_relaxed);
+		time_stats_.slewed_us.fetch_add(std::abs(adjust_us), std::memory_order_relaxed);
+		time_stats_.last_slew_us.store(adjust_us, std::memory_order_relaxed);
+		ESP_LOGD(TAG, "Time slew: %" PRId64 "us", adjust_us);
+	}
+}
+
+bool Network::time_adjust(int64_t adjust_us) {
+	struct timeval now{};
+
+	if (::gettimeofday(&now, nullptr)) {
+		time_stats_.failures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	now.tv_sec += adjust_us / ONE_SECOND_US;
+	now.tv_usec += adjust_us % ONE_SECOND_US;
+
+	if (now.tv_usec < 0) {
+		now.tv_sec--;
+		now.tv_usec += ONE_SECOND_US;
+	} else if (now.tv_usec >= ONE_SECOND_US) {
+		now.tv_sec++;
+		now.tv_usec -= ONE_SECOND_US;
+	}
+
+	if (::settimeofday(&now, nullptr)) {
+		ESP_LOGE(TAG, "Time adjustment %" PRId64 "us failed: %d", adjust_us, errno);
+		time_stats_.failures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	time_applied_us_ += adjust_us;
+	return true;
+}
+
+int64_t Network::time_rate() {
+	std::lock_guard lock{time_mutex_};
+
+	return ClockMapping::rate_from_frequency(time_discipline_.frequency_ppm() / 1e6);
+}
+
+/*
+ * Offsets from NTP are used as samples for the clock discipline, which
+ * corrects the system clock before each transmission. The clock is stepped
+ * instead for the first offset, for large offsets and when the phase has
+ * changed by more than can be slewed at once.
+ */
+void Network::time_offset(int64_t offset_us) {
+	std::lock_guard lock{time_mutex_};
+	bool step = offset_us < LOWER_TIME_STEP_US || offset_us >= UPPER_TIME_STEP_US
+		|| time_step_first_;
+	bool used = false;
+
+	time_stats_.last_offset_us.store(std::clamp(offset_us, (int64_t)INT32_MIN,
+		(int64_t)INT32_MAX), std::memory_order_relaxed);
+
+	if (!step) {
+		used = time_discipline_.sample(esp_timer_get_time(), offset_us);
+		step = std::abs(time_discipline_.phase_jump_us()) > UPPER_TIME_SLEW_US;
+	}
+
+	if (step) {
+		if (!time_adjust(offset_us)) {
+			return;
+		}
+
+		time_step_first_ = false;
+		time_discipline_.step(esp_timer_get_time());
+		time_stats_.steps.fetch_add(1, std::memory_order_relaxed);
+		ESP_LOGI(TAG, "Time step: %+" PRId64 "us", offset_us);
+	} else {
+		(used ? time_stats_.offsets_used : time_stats_.offsets_ignored)
+			.fetch_add(1, std::memory_order_relaxed);
+		time_stats_.frequency_ppb.store(
+			std::lround(time_discipline_.frequency_ppm() * 1000.0),
+			std::memory_order_relaxed);
+		time_stats_.drift_ppb_per_hour.store(
+			std::lround(time_discipline_.drift_ppm_per_hour() * 1000.0),
+			std::memory_order_relaxed);
+
+		ESP_LOGI(TAG, "Time offset: %+" PRId64 "us (%s, residual %+.0fus,"
+			" frequency %+.3fppm)", offset_us, used ? "used" : "ignored",
+			time_discipline_.residual_us(), time_discipline_.frequency_ppm());
+	}
+
+	const uint32_t bound_seq = time_bound_seq_.load(std::memory_order_relaxed) + 1;
+
+	std::atomic_thread_fence(std::memory_order_release);
+	time_bound_[bound_seq & 1U] = time_discipline_.bound();
+	time_bound_seq_.store(bound_seq, std::memory_order_release);
+
+	time_sync_us_ = esp_timer_get_time();
+	time_valid_until_us_.store(time_discipline_.error_limit_uptime_us(
+		TIME_ERROR_LIMIT_US), std::memory_order_relaxed);
+	ESP_LOGD(TAG, "Time valid for %" PRIu64 "s without another sync",
+		(time_valid_until_us() - std::min(time_valid_until_us(), time_sync_us_))
+		/ ONE_SECOND_US);
+	Status::changed(Status::TIME_SYNC);
+
+	if (!time_first_sync_us_) {
+		time_first_sync_us_ = time_sync_us_;
+		ESP_LOGI(TAG, "Time synced %" PRIu64 "ms after boot",
+			time_first_sync_us_ / 1000U);
+	}
+}
+
+} // namespace clockson
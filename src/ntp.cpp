@@ -0,0 +1,474 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/ntp.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace clockson {
+
+void NtpServer::add(const Sample &sample) {
+	filter_[next_] = sample;
+	next_ = (next_ + 1) % FILTER_SIZE;
+	count_ = std::min(count_ + 1, FILTER_SIZE);
+	reach_ = (reach_ << 1) | 1U;
+
+	best_ = 0;
+	for (size_t i = 1; i < count_; i++) {
+		if (filter_[i].delay_us < filter_[best_].delay_us) {
+			best_ = i;
+		}
+	}
+
+	double sum_us2 = 0.0;
+
+	for (size_t i = 0; i < count_; i++) {
+		const double diff_us = filter_[i].offset_us - filter_[best_].offset_us;
+
+		sum_us2 += diff_us * diff_us;
+	}
+
+	jitter_us_ = count_ > 1 ? std::sqrt(sum_us2 / (count_ - 1)) : 0.0;
+	jitter_us_ = std::max(jitter_us_, MIN_JITTER_US);
+}
+
+void NtpServer::missed() {
+	reach_ <<= 1;
+}
+
+void NtpServer::reset() {
+	*this = NtpServer{};
+}
+
+double NtpServer::distance_us(uint64_t uptime_us) const {
+	const Sample &sample = best();
+	const double age_us = uptime_us > sample.uptime_us
+		? uptime_us - sample.uptime_us : 0.0;
+
+	return sample.delay_us / 2.0 + sample.dispersion_us + jitter_us_
+		+ PHI * age_us;
+}
+
+NtpSelection NtpSelection::select(std::span<NtpServer> servers,
+		uint64_t uptime_us, int64_t applied_us) {
+	struct Candidate {
+		NtpServer *server;
+		double offset_us;
+		double distance_us;
+	};
+	struct Edge {
+		double value_us;
+		/* -1 = lowest, 0 = offset, +1 = highest */
+		int type;
+	};
+	NtpSelection result{};
+	std::array<Candidate, MAX_CANDIDATES> candidates;
+	std::array<Edge, MAX_CANDIDATES * 3> edges;
+	size_t count = 0;
+
+	for (auto &server : servers) {
+		server.state(NtpServer::State::NONE);
+
+		if (!server.valid() || count == candidates.size()) {
+			continue;
+		}
+
+		const double distance_us = server.distance_us(uptime_us);
+
+		if (distance_us > MAX_DISTANCE_US) {
+			continue;
+		}
+
+		const double offset_us = server.best().offset_us - applied_us;
+
+		candidates[count] = {&server, offset_us, distance_us};
+		edges[count * 3] = {offset_us - distance_us, -1};
+		edges[count * 3 + 1] = {offset_us, 0};
+		edges[count * 3 + 2] = {offset_us + distance_us, +1};
+		count++;
+	}
+
+	result.candidates = count;
+
+	if (count == 0) {
+		return result;
+	}
+
+	std::sort(edges.begin(), edges.begin() + count * 3,
+		[] (const Edge &a, const Edge &b) {
+			return a.value_us < b.value_us
+				|| (a.value_us == b.value_us && a.type < b.type);
+		});
+
+	/*
+	 * Find the smallest interval that contains the offsets of the most
+	 * servers, allowing for an increasing number of falsetickers until
+	 * there's no longer a majority.
+	 */
+	const int n = count;
+	double low_us = 0.0;
+	double high_us = 0.0;
+	bool intersection = false;
+
+	for (int allow = 0; 2 * allow < n && !intersection; allow++) {
+		int found = 0;
+		int chime = 0;
+		bool have_low = false;
+		bool have_high = false;
+
+		for (int i = 0; i < n * 3; i++) {
+			chime -= edges[i].type;
+			if (chime >= n - allow) {
+				low_us = edges[i].value_us;
+				have_low = true;
+				break;
+			}
+			if (edges[i].type == 0) {
+				found++;
+			}
+		}
+
+		chime = 0;
+		for (int i = n * 3 - 1; i >= 0; i--) {
+			chime += edges[i].type;
+			if (chime >= n - allow) {
+				high_us = edges[i].value_us;
+				have_high = true;
+				break;
+			}
+			if (edges[i].type == 0) {
+				found++;
+			}
+		}
+
+		if (found > allow || !have_low || !have_high) {
+			continue;
+		}
+
+		intersection = high_us > low_us;
+	}
+
+	if (!intersection) {
+		result.falsetickers = count;
+		for (size_t i = 0; i < count; i++) {
+			candidates[i].server->state(NtpServer::State::FALSETICKER);
+		}
+		return result;
+	}
+
+	size_t survivors = 0;
+
+	/* Servers with a range that overlaps the intersection are truechimers */
+	for (size_t i = 0; i < count; i++) {
+		if (candidates[i].offset_us + candidates[i].distance_us < low_us
+				|| candidates[i].offset_us - candidates[i].distance_us > high_us) {
+			candidates[i].server->state(NtpServer::State::FALSETICKER);
+			result.falsetickers++;
+		} else {
+			candidates[survivors++] = candidates[i];
+		}
+	}
+
+	/*
+	 * Remove the server with the largest spread of differences from the
+	 * other servers, until that's no larger than the smallest jitter of the
+	 * servers themselves.
+	 */
+	while (survivors > MIN_SURVIVORS) {
+		size_t worst = 0;
+		double worst_jitter_us = 0.0;
+		double min_jitter_us = INFINITY;
+
+		for (size_t i = 0; i < survivors; i++) {
+			double sum_us2 = 0.0;
+
+			for (size_t j = 0; j < survivors; j++) {
+				const double diff_us = candidates[i].offset_us - candidates[j].offset_us;
+
+				sum_us2 += diff_us * diff_us;
+			}
+
+			const double jitter_us = std::sqrt(sum_us2 / (survivors - 1));
+
+			if (jitter_us > worst_jitter_us) {
+				worst = i;
+				worst_jitter_us = jitter_us;
+			}
+
+			min_jitter_us = std::min(min_jitter_us, candidates[i].server->jitter_us());
+		}
+
+		if (worst_jitter_us <= min_jitter_us) {
+			break;
+		}
+
+		candidates[worst].server->state(NtpServer::State::OUTLIER);
+		candidates[worst] = candidates[--survivors];
+	}
+
+	/* Weight the remaining servers by the inverse of their distance */
+	double sum_weight = 0.0;
+	double sum_offset_us = 0.0;
+
+	for (size_t i = 0; i < survivors; i++) {
+		const double weight = 1.0 / candidates[i].distance_us;
+
+		candidates[i].server->state(NtpServer::State::SURVIVOR);
+		sum_weight += weight;
+		sum_offset_us += weight * candidates[i].offset_us;
+	}
+
+	const double offset_us = sum_offset_us / sum_weight;
+	double sum_us2 = 0.0;
+
+	for (size_t i = 0; i < survivors; i++) {
+		const double diff_us = candidates[i].offset_us - offset_us;
+
+		sum_us2 += diff_us * diff_us / candidates[i].distance_us;
+	}
+
+	result.valid = true;
+	result.offset_us = std::llround(offset_us);
+	result.jitter_us = std::sqrt(sum_us2 / sum_weight);
+	result.survivors = survivors;
+	return result;
+}
+
+NtpClient::NtpClient(clock_t wall, clock_t uptime, applied_t applied)
+		: wall_(wall), uptime_(uptime), applied_(applied) {
+}
+
+NtpClient::~NtpClient() {
+	if (socket_ != -1) {
+		::close(socket_);
+	}
+}
+
+void NtpClient::server(size_t index, const struct sockaddr_in *addr) {
+	Server &server = servers_[index];
+
+	if (addr == nullptr) {
+		if (server.configured) {
+			server = Server{};
+			stats_[index].reset();
+		}
+	} else if (!server.configured
+			|| server.addr.sin_addr.s_addr != addr->sin_addr.s_addr
+			|| server.addr.sin_port != addr->sin_port) {
+		server = Server{};
+		server.addr = *addr;
+		server.configured = true;
+		stats_[index].reset();
+	}
+}
+
+bool NtpClient::open() {
+	if (socket_ == -1) {
+		socket_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	}
+
+	return socket_ != -1;
+}
+
+bool NtpClient::poll(uint32_t timeout_ms) {
+	const int64_t applied_us = applied_();
+	size_t pending = 0;
+
+	for (auto &server : servers_) {
+		server.pending = false;
+		server.received = false;
+
+		if (!server.configured || !open()) {
+			continue;
+		}
+
+		std::array<uint8_t, PACKET_SIZE> packet{};
+
+		/* No leap second warning, version 4, client mode */
+		packet[0] = (0 << 6) | (4 << 3) | 3;
+		server.request_us = wall_();
+		server.request_ts = to_ntp(server.request_us);
+		write64(&packet[40], server.request_ts);
+
+		if (::sendto(socket_, packet.data(), packet.size(), 0,
+				reinterpret_cast<const struct sockaddr*>(&server.addr),
+				sizeof(server.addr)) == (ssize_t)packet.size()) {
+			server.pending = true;
+			pending++;
+		}
+	}
+
+	const uint64_t deadline_us = uptime_() + timeout_ms * 1000ULL;
+
+	while (pending > 0) {
+		const uint64_t now_us = uptime_();
+
+		if (now_us >= deadline_us) {
+			break;
+		}
+
+		struct timeval timeout{};
+		fd_set fds;
+
+		timeout.tv_sec = (deadline_us - now_us) / 1000000U;
+		timeout.tv_usec = (deadline_us - now_us) % 1000000U;
+		FD_ZERO(&fds);
+		FD_SET(socket_, &fds);
+
+		int ret = ::select(socket_ + 1, &fds, nullptr, nullptr, &timeout);
+
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			break;
+		}
+
+		/* Allow for extension fields and a MAC after the header */
+		std::array<uint8_t, 128> packet;
+		struct sockaddr_in from{};
+		socklen_t from_len = sizeof(from);
+		ssize_t len = ::recvfrom(socket_, packet.data(), packet.size(), 0,
+			reinterpret_cast<struct sockaddr*>(&from), &from_len);
+		const uint64_t receive_us = wall_();
+
+		if (len < (ssize_t)PACKET_SIZE || from.sin_family != AF_INET) {
+			continue;
+		}
+
+		for (auto &server : servers_) {
+			if (server.pending
+					&& server.addr.sin_addr.s_addr == from.sin_addr.s_addr
+					&& server.addr.sin_port == from.sin_port
+					&& read64(&packet[24]) == server.request_ts) {
+				receive(server, packet.data(), receive_us, applied_us);
+				pending--;
+				break;
+			}
+		}
+	}
+
+	/*
+	 * The offsets are stored relative to the uncorrected clock, which can't
+	 * be done if the correction changed during the poll
+	 */
+	if (applied_() != applied_us) {
+		return false;
+	}
+
+	for (size_t i = 0; i < servers_.size(); i++) {
+		if (!servers_[i].configured) {
+			continue;
+		}
+
+		if (servers_[i].received) {
+			stats_[i].add(servers_[i].sample);
+		} else {
+			stats_[i].missed();
+		}
+	}
+
+	return true;
+}
+
+void NtpClient::receive(Server &server, const uint8_t *packet,
+		uint64_t receive_us, int64_t applied_us) {
+	const unsigned int leap = packet[0] >> 6;
+	const unsigned int version = (packet[0] >> 3) & 7U;
+	const unsigned int mode = packet[0] & 7U;
+	const unsigned int stratum = packet[1];
+
+	server.pending = false;
+
+	/* Unsynchronised servers and kiss-o'-death packets are unusable */
+	if (leap == 3 || version < 3 || mode != 4 || stratum == 0 || stratum >= 16) {
+		return;
+	}
+
+	const int64_t t1 = server.request_us;
+	const int64_t t2 = from_ntp(read64(&packet[32]), server.request_us);
+	const int64_t t3 = from_ntp(read64(&packet[40]), server.request_us);
+	const int64_t t4 = receive_us;
+	const uint64_t root_delay_us = ((uint64_t)read32(&packet[4]) * 1000000U) >> 16;
+	const uint64_t root_dispersion_us = ((uint64_t)read32(&packet[8]) * 1000000U) >> 16;
+
+	server.received = true;
+	server.sample.offset_us = ((t2 - t1) + (t3 - t4)) / 2 + applied_us;
+	server.sample.delay_us = std::max((t4 - t1) - (t3 - t2), (int64_t)0);
+	server.sample.dispersion_us = root_delay_us / 2 + root_dispersion_us;
+	server.sample.uptime_us = uptime_();
+}
+
+NtpSelection NtpClient::select() {
+	return NtpSelection::select(stats_, uptime_(), applied_());
+}
+
+uint64_t NtpClient::to_ntp(uint64_t wall_us) {
+	const uint64_t seconds = wall_us / 1000000U + EPOCH_OFFSET_S;
+	const uint64_t fraction = ((wall_us % 1000000U) << 32) / 1000000U;
+
+	return (seconds << 32) | fraction;
+}
+
+/*
+ * NTP timestamps wrap every 136 years, so use the era that's closest to the
+ * reference time
+ */
+uint64_t NtpClient::from_ntp(uint64_t ts, uint64_t reference_us) {
+	const uint64_t reference_s = std::max(reference_us / 1000000U + EPOCH_OFFSET_S,
+		ERA_PIVOT_S);
+	const int64_t seconds = reference_s
+		+ (int32_t)((uint32_t)(ts >> 32) - (uint32_t)reference_s);
+	const uint64_t fraction_us = ((ts & 0xFFFFFFFFU) * 1000000U) >> 32;
+
+	if (seconds < (int64_t)EPOCH_OFFSET_S) {
+		return 0;
+	}
+
+	return (seconds - EPOCH_OFFSET_S) * 1000000U + fraction_us;
+}
+
+uint64_t NtpClient::read64(const uint8_t *data) {
+	return ((uint64_t)read32(data) << 32) | read32(data + 4);
+}
+
+uint32_t NtpClient::read32(const uint8_t *data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+		| ((uint32_t)data[2] << 8) | data[3];
+}
+
+void NtpClient::write64(uint8_t *data, uint64_t value) {
+	for (int i = 7; i >= 0; i--) {
+		data[i] = value & 0xFFU;
+		value >>= 8;
+	}
+}
+
+} // namespace clockson
@@ -0,0 +1,144 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/power_save.h"
+
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+#include <esp_err.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace clockson {
+
+esp_pm_lock_handle_t PowerSave::no_light_sleep_{nullptr};
+esp_pm_lock_handle_t PowerSave::cpu_freq_max_{nullptr};
+bool PowerSave::awake_{false};
+uint64_t PowerSave::wake_us_{0};
+uint32_t PowerSave::peak_us_{0};
+std::atomic<uint32_t> PowerSave::margin_us_{INITIAL_MARGIN_US};
+std::atomic<uint32_t> PowerSave::wakes_{0};
+std::atomic<uint32_t> PowerSave::late_wakes_{0};
+uint64_t PowerSave::sleep_start_us_{0};
+std::atomic<uint64_t> PowerSave::sleep_us_{0};
+std::atomic<uint32_t> PowerSave::sleeps_{0};
+uint64_t PowerSave::reported_us_{0};
+uint64_t PowerSave::reported_sleep_us_{0};
+
+void PowerSave::init() {
+	esp_pm_config_t pm_config{};
+
+	pm_config.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+	pm_config.min_freq_mhz = CONFIG_XTAL_FREQ;
+	pm_config.light_sleep_enable = true;
+
+	ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "transmit", &no_light_sleep_));
+	ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "transmit", &cpu_freq_max_));
+
+	esp_pm_sleep_cbs_register_config_t callbacks{};
+
+	callbacks.enter_cb = sleep_enter;
+	callbacks.exit_cb = sleep_exit;
+
+	ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&callbacks));
+	ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+}
+
+void PowerSave::sleep(uint64_t wake_us) {
+	wake_us_ = wake_us;
+
+	if (awake_) {
+		ESP_ERROR_CHECK(esp_pm_lock_release(cpu_freq_max_));
+		ESP_ERROR_CHECK(esp_pm_lock_release(no_light_sleep_));
+		awake_ = false;
+	}
+}
+
+void PowerSave::wake(uint64_t uptime_us) {
+	if (awake_) {
+		return;
+	}
+
+	ESP_ERROR_CHECK(esp_pm_lock_acquire(no_light_sleep_));
+	ESP_ERROR_CHECK(esp_pm_lock_acquire(cpu_freq_max_));
+	awake_ = true;
+
+	if (!wake_us_) {
+		return;
+	}
+
+	uint32_t latency_us = std::min(uptime_us - std::min(uptime_us, wake_us_),
+		(uint64_t)MAX_MARGIN_US);
+	uint32_t margin_us = margin_us_.load(std::memory_order_relaxed);
+
+	wake_us_ = 0;
+	wakes_.fetch_add(1, std::memory_order_relaxed);
+
+	if (latency_us >= margin_us) {
+		late_wakes_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	peak_us_ = std::max(latency_us, peak_us_ - peak_us_ / PEAK_DECAY);
+	margin_us_.store(std::clamp(peak_us_ + peak_us_ / 4 + MIN_MARGIN_US,
+		MIN_MARGIN_US, MAX_MARGIN_US), std::memory_order_relaxed);
+}
+
+esp_err_t PowerSave::sleep_enter(int64_t sleep_time_us, void *arg) {
+	sleep_start_us_ = esp_timer_get_time();
+	return ESP_OK;
+}
+
+esp_err_t PowerSave::sleep_exit(int64_t sleep_time_us, void *arg) {
+	sleep_us_.fetch_add(esp_timer_get_time() - sleep_start_us_, std::memory_order_relaxed);
+	sleeps_.fetch_add(1, std::memory_order_relaxed);
+	return ESP_OK;
+}
+
+PowerSave::Totals PowerSave::totals() {
+	return {
+		sleep_us_.load(std::memory_order_relaxed),
+		sleeps_.load(std::memory_order_relaxed),
+		wakes_.load(std::memory_order_relaxed),
+		late_wakes_.load(std::memory_order_relaxed),
+		margin_us_.load(std::memory_order_relaxed),
+	};
+}
+
+void PowerSave::summary(char *text, size_t size) {
+	uint64_t now_us = esp_timer_get_time();
+	Totals totals = PowerSave::totals();
+
+	std::snprintf(text, size, "Power: light sleep %.1f%% of the time"
+		" (%" PRIu32 " times), %" PRIu32 " wake ups (%" PRIu32 " late),"
+		" wake margin %" PRIu32 "us",
+		(totals.sleep_us - reported_sleep_us_) * 100.0
+			/ std::max(now_us - reported_us_, (uint64_t)1),
+		totals.sleeps, totals.wakes, totals.late_wakes, totals.margin_us);
+
+	reported_us_ = now_us;
+	reported_sleep_us_ = totals.sleep_us;
+}
+
+} // namespace clockson
+#endif
@@ -0,0 +1,210 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/standard.h"
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+#include "clockson/calendar.h"
+#include "clockson/civil.h"
+
+namespace clockson {
+
+namespace standard {
+
+void set_bcd(data_t &data, size_t begin, size_t end, unsigned int value) {
+	size_t i = end;
+
+	while (i >= begin) {
+		std::bitset<4> bits{value % 10U};
+
+		value /= 10U;
+
+		for (size_t j = 0; j < 4 && i >= begin; j++) {
+			data[i] = bits[j];
+
+			if (i == begin) {
+				return;
+			}
+
+			i--;
+		}
+	}
+}
+
+void set_bcd_lsb(data_t &data, size_t begin, size_t end, unsigned int value) {
+	size_t i = begin;
+
+	while (i <= end) {
+		std::bitset<4> bits{value % 10U};
+
+		value /= 10U;
+
+		for (size_t j = 0; j < 4 && i <= end; j++, i++) {
+			data[i] = bits[j];
+		}
+	}
+}
+
+bool odd_parity(const data_t &data, size_t begin, size_t end) {
+	bool parity = true;
+
+	for (size_t i = begin; i <= end; i++) {
+		parity ^= data[i];
+	}
+
+	return parity;
+}
+
+void MSF::encode(Frame &frame, const Calendar &time, const Calendar *previous) {
+	if (!previous) {
+		/* Minute identifier */
+		frame.a[53] = true;
+		frame.a[54] = true;
+		frame.a[55] = true;
+		frame.a[56] = true;
+		frame.a[57] = true;
+		frame.a[58] = true;
+	}
+
+	/*
+	 * The year and month can only change when the day changes, and the
+	 * weekday always changes with the day.
+	 */
+	if (!previous || time.year() != previous->year()) {
+		set_bcd(frame.a, 17, 24, time.year() % 100U);
+		frame.b[54] = odd_parity(frame.a, 17, 24);
+	}
+
+	if (!previous || time.day() != previous->day()) {
+		set_bcd(frame.a, 25, 29, time.month());
+		set_bcd(frame.a, 30, 35, time.day());
+		frame.b[55] = odd_parity(frame.a, 25, 35);
+
+		set_bcd(frame.a, 36, 38, time.weekday());
+		frame.b[56] = odd_parity(frame.a, 36, 38);
+	}
+
+	if (!previous || time.hour() != previous->hour()) {
+		set_bcd(frame.a, 39, 44, time.hour());
+	}
+
+	set_bcd(frame.a, 45, 51, time.minute());
+	frame.b[57] = odd_parity(frame.a, 39, 51);
+
+	frame.b[53] = time.summer_change_soon();
+	frame.b[58] = time.summer();
+}
+
+void DCF77::encode(Frame &frame, const Calendar &time, const Calendar *previous) {
+	if (!previous) {
+		/* Start of encoded time */
+		frame[20] = true;
+	}
+
+	frame[16] = time.summer_change_soon();
+	frame[17] = time.summer();
+	frame[18] = !time.summer();
+
+	set_bcd_lsb(frame, 21, 27, time.minute());
+	frame[28] = even_parity(frame, 21, 27);
+
+	if (!previous || time.hour() != previous->hour()) {
+		set_bcd_lsb(frame, 29, 34, time.hour());
+		frame[35] = even_parity(frame, 29, 34);
+	}
+
+	if (!previous || time.day() != previous->day()) {
+		set_bcd_lsb(frame, 36, 41, time.day());
+		/* 1 = Monday, 7 = Sunday */
+		set_bcd_lsb(frame, 42, 44, time.weekday() == 0 ? 7 : time.weekday());
+		set_bcd_lsb(frame, 45, 49, time.month());
+		set_bcd_lsb(frame, 50, 57, time.year() % 100U);
+		frame[58] = even_parity(frame, 36, 57);
+	}
+}
+
+void WWVB::encode(Frame &frame, const Calendar &time, const Calendar *previous) {
+	if (!previous) {
+		/* DUT1 is always reported as +0.0s */
+		frame[36] = true;
+		frame[38] = true;
+	}
+
+	set_bcd(frame, 1, 3, time.minute() / 10U);
+	set_bcd(frame, 5, 8, time.minute() % 10U);
+
+	if (!previous || time.hour() != previous->hour()) {
+		set_bcd(frame, 12, 13, time.hour() / 10U);
+		set_bcd(frame, 15, 18, time.hour() % 10U);
+	}
+
+	if (!previous || time.day() != previous->day()) {
+		const uint16_t day_of_year = time.day_of_year();
+
+		set_bcd(frame, 22, 23, day_of_year / 100U);
+		set_bcd(frame, 25, 28, day_of_year / 10U % 10U);
+		set_bcd(frame, 30, 33, day_of_year % 10U);
+
+		set_bcd(frame, 45, 48, time.year() / 10U % 10U);
+		set_bcd(frame, 50, 53, time.year() % 10U);
+		frame[55] = civil::leap_year(time.year());
+
+		/*
+		 * US daylight saving time starts on the second Sunday in March and
+		 * ends on the first Sunday in November, at 02:00 local time (which
+		 * is always after 00:00 UTC). Indicate whether it's in effect at
+		 * 24:00 UTC and 00:00 UTC today.
+		 */
+		const uint64_t today = civil::to_days(time.year(), time.month(), time.day());
+		const uint64_t begin = civil::sunday_from(civil::to_days(time.year(), 3, 8));
+		const uint64_t end = civil::sunday_from(civil::to_days(time.year(), 11, 1));
+
+		frame[57] = today >= begin && today < end;
+		frame[58] = today > begin && today <= end;
+	}
+}
+
+void JJY::encode(Frame &frame, const Calendar &time, const Calendar *previous) {
+	set_bcd(frame, 1, 3, time.minute() / 10U);
+	set_bcd(frame, 5, 8, time.minute() % 10U);
+	frame[37] = even_parity(frame, 1, 8);
+
+	if (!previous || time.hour() != previous->hour()) {
+		set_bcd(frame, 12, 13, time.hour() / 10U);
+		set_bcd(frame, 15, 18, time.hour() % 10U);
+		frame[36] = even_parity(frame, 12, 18);
+	}
+
+	if (!previous || time.day() != previous->day()) {
+		const uint16_t day_of_year = time.day_of_year();
+
+		set_bcd(frame, 22, 23, day_of_year / 100U);
+		set_bcd(frame, 25, 28, day_of_year / 10U % 10U);
+		set_bcd(frame, 30, 33, day_of_year % 10U);
+
+		set_bcd(frame, 41, 48, time.year() % 100U);
+		set_bcd(frame, 50, 52, time.weekday());
+	}
+}
+
+} // namespace standard
+
+} // namespace clockson
@@ -0,0 +1,45 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/status.h"
+
+#include <freertos/event_groups.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace clockson {
+
+StaticEventGroup_t Status::buffer_;
+EventGroupHandle_t Status::events_{xEventGroupCreateStatic(&buffer_)};
+
+void Status::changed(EventBits_t bits) {
+	xEventGroupSetBits(events_, bits);
+}
+
+EventBits_t Status::wait(uint64_t timeout_us) {
+	constexpr uint64_t tick_us = portTICK_PERIOD_MS * 1000U;
+	/* Round up so that the timeout is never early */
+	TickType_t ticks = timeout_us == UINT64_MAX ? portMAX_DELAY
+		: std::min<uint64_t>(timeout_us / tick_us + (timeout_us % tick_us != 0),
+			portMAX_DELAY - 1);
+
+	return xEventGroupWaitBits(events_, ALL, pdTRUE, pdFALSE, ticks) & ALL;
+}
+
+} // namespace clockson
@@ -0,0 +1,119 @@
+/*
+ * tempus-redux - ESP32 "Time from NPL" (MSF) Radio clock signal generator
+ * Copyright 2024  Simon Arlott
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clockson/task_usage.h"
+
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace clockson {
+
+std::mutex TaskUsage::mutex_;
+std::array<TaskStatus_t, TaskUsage::MAX_TASKS> TaskUsage::status_;
+std::array<TaskUsage::Task, TaskUsage::MAX_TASKS> TaskUsage::tasks_;
+uint64_t TaskUsage::sample_us_{0};
+uint64_t TaskUsage::reported_us_{0};
+
+bool TaskUsage::update() {
+	std::lock_guard lock{mutex_};
+	UBaseType_t count = uxTaskGetSystemState(status_.data(), status_.size(), nullptr);
+	uint64_t now_us = esp_timer_get_time();
+
+	if (!count) {
+		return false;
+	}
+
+	for (auto &task : tasks_) {
+		task.present = false;
+	}
+
+	for (UBaseType_t i = 0; i < count; i++) {
+		const TaskStatus_t &status = status_[i];
+		Task *task = find(status.xTaskNumber);
+
+		if (task) {
+			/* Unsigned arithmetic handles the counter wrapping */
+			task->total_us += status.ulRunTimeCounter - task->counter;
+		} else {
+			/* Unused entries have a task number of 0 */
+			task = find(0);
+
+			if (!task) {
+				continue;
+			}
+
+			task->number = status.xTaskNumber;
+			std::strncpy(task->name.data(), status.pcTaskName, task->name.size() - 1);
+			task->core = status.xCoreID == tskNO_AFFINITY ? -1 : status.xCoreID;
+			task->total_us = status.ulRunTimeCounter;
+			task->reported_us = 0;
+		}
+
+		task->counter = status.ulRunTimeCounter;
+		task->stack_free = status.usStackHighWaterMark;
+		task->present = true;
+	}
+
+	/* Forget about tasks that have been deleted */
+	for (auto &task : tasks_) {
+		if (!task.present) {
+			task = {};
+		}
+	}
+
+	sample_us_ = now_us;
+	return true;
+}
+
+TaskUsage::Task* TaskUsage::find(UBaseType_t number) {
+	auto it = std::find_if(tasks_.begin(), tasks_.end(),
+		[number] (const Task &task) { return task.number == number; });
+
+	return it == tasks_.end() ? nullptr : &*it;
+}
+
+bool TaskUsage::task(size_t index, char *text, size_t size) {
+	Task &task = tasks_[index];
+
+	if (!task.number || sample_us_ <= reported_us_) {
+		return false;
+	}
+
+	/* Percentage of one core */
+	double usage = (task.total_us - task.reported_us) * 100.0
+		/ (sample_us_ - reported_us_);
+	std::array<char, 8> core{"any"};
+
+	if (task.core >= 0) {
+		std::snprintf(core.data(), core.size(), "%d", task.core);
+	}
+
+	std::snprintf(text, size, "Task %s (core %s): CPU %.1f%%, stack %u free",
+		task.name.data(), core.data(), usage, (unsigned int)task.stack_free);
+	task.reported_us = task.total_us;
+	return true;
+}
+
+} // namespace clockson
@@ -18,115 +18,64 @@
 
 #include "clockson/time_signal.h"
 
-#include <bitset>
-#include <cstddef>
 #include <cstdint>
 #include <chrono>
 #include <ctime>
 
 #include "clockson/calendar.h"
+#include "clockson/clock_mapping.h"
+#include "clockson/standard.h"
 
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
-using std::chrono::milliseconds;
 using std::chrono::minutes;
 using std::chrono::seconds;
 
 namespace clockson {
 
-TimeSignal::TimeSignal() : time_(0) {
+template <class Standard>
+BasicTimeSignal<Standard>::BasicTimeSignal() : time_(0) {
 }
 
-TimeSignal::TimeSignal(time_t t, uint64_t offset_us) : time_(t) {
-	data_t a, b;
-
-	set_bcd(a, 17, 24, time_.year() % 100U);
-	set_bcd(a, 25, 29, time_.month());
-	set_bcd(a, 30, 35, time_.day());
-	set_bcd(a, 36, 38, time_.weekday());
-	set_bcd(a, 39, 44, time_.hour());
-	set_bcd(a, 45, 51, time_.minute());
-
-	/* Minute identifier */
-	a[53] = true;
-	a[54] = true;
-	a[55] = true;
-	a[56] = true;
-	a[57] = true;
-	a[58] = true;
-
-	b[53] = time_.summer_change_soon();
-	b[58] = time_.summer();
-
-	b[54] = odd_parity(a, 17, 24);
-	b[55] = odd_parity(a, 25, 35);
-	b[56] = odd_parity(a, 36, 38);
-	b[57] = odd_parity(a, 39, 51);
-
-	auto ts = duration_cast<microseconds>(seconds{time_.utc_time()});
-
-	ts -= microseconds{offset_us};
-
-	/* Transmit time one minute before */
-	ts -= minutes{1};
-
-	/* Minute marker */
-	values_.emplace_back(ts.count(), false);
-	ts += milliseconds{500};
-	values_.emplace_back(ts.count(), true);
-	ts += milliseconds{500};
-
-	/* Second markers */
-	for (size_t i = 1; i <= 59; i++) {
-		values_.emplace_back(ts.count(), false);
-		ts += milliseconds{100};
-
-		if (!a[i]) {
-			values_.emplace_back(ts.count(), true);
-		}
-		ts += milliseconds{100};
-
-		if (b[i] != a[i]) {
-			values_.emplace_back(ts.count(), !b[i]);
-		}
-		ts += milliseconds{100};
-
-		if (b[i]) {
-			values_.emplace_back(ts.count(), true);
-		}
-		ts += milliseconds{700};
-	}
+template <class Standard>
+BasicTimeSignal<Standard>::BasicTimeSignal(time_t t, const ClockMapping &clock)
+		: time_(t) {
+	Standard::encode(frame_, time_, nullptr);
+	start(clock);
 }
 
-inline void TimeSignal::set_bcd(data_t &data, size_t begin, size_t end,
-		unsigned int value) {
-	size_t i = end;
-
-	while (i >= begin) {
-		std::bitset<4> bits{value % 10U};
-
-		value /= 10U;
-
-		for (size_t j = 0; j < 4 && i >= begin; j++) {
-			data[i] = bits[j];
-
-			if (i == begin) {
-				return;
-			}
+template <class Standard>
+BasicTimeSignal<Standard>::BasicTimeSignal(const BasicTimeSignal &previous,
+		const ClockMapping &clock)
+		: time_(previous.time_.next()), frame_(previous.frame_) {
+	Standard::encode(frame_, time_, &previous.time_);
+	start(clock);
+}
 
-			i--;
-		}
-	}
+template <class Standard>
+BasicTimeSignal<Standard> BasicTimeSignal<Standard>::next_minute(const ClockMapping &clock) const {
+	return BasicTimeSignal{*this, clock};
 }
 
-inline bool TimeSignal::odd_parity(const data_t &data, size_t begin, size_t end) {
-	bool parity = true;
+template <class Standard>
+void BasicTimeSignal<Standard>::start(const ClockMapping &clock) {
+	auto ts = duration_cast<microseconds>(seconds{time_.utc_time()});
 
-	for (size_t i = begin; i <= end; i++) {
-		parity ^= data[i];
+	if constexpr (Standard::NEXT_MINUTE) {
+		/* Transmit time one minute before */
+		ts -= minutes{1};
 	}
 
-	return parity;
+	start_us_ = clock.uptime(ts.count());
+	rate_ = clock.rate();
+	second_ = 0;
+	edge_ = 0;
+	skip_empty();
 }
 
+template class BasicTimeSignal<standard::MSF>;
+template class BasicTimeSignal<standard::DCF77>;
+template class BasicTimeSignal<standard::WWVB>;
+template class BasicTimeSignal<standard::JJY>;
+
 } // namespace clockson
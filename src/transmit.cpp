@@ -21,25 +21,71 @@
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <driver/gpio.h>
+#include <freertos/task.h>
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+# include <driver/gptimer.h>
+#endif
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+# include <driver/rmt_tx.h>
+# include <soc/soc_caps.h>
+#elif defined(CONFIG_CLOCKSON_OUTPUT_CARRIER)
+# include <driver/ledc.h>
+#endif
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstddef>
 #include <cstdio>
-#include <vector>
 
+#include "clockson/clock_mapping.h"
 #include "clockson/network.h"
+#include "clockson/power_save.h"
+#include "clockson/schedule.h"
+#include "clockson/status.h"
 #include "clockson/time_signal.h"
 
 using std::chrono::duration_cast;
-using std::chrono::time_point_cast;
 using std::chrono::microseconds;
 using std::chrono::seconds;
-using std::chrono::system_clock;
 using namespace std::chrono_literals;
 
 namespace clockson {
 
-Transmit::Transmit(Network &network, gpio_num_t pin, bool active_low)
-		: network_(network), pin_(pin), active_low_(active_low) {
+#if !defined(CONFIG_CLOCKSON_OUTPUT_GPTIMER) && defined(CONFIG_ESP_TIMER_TASK_AFFINITY)
+/* The transmit path runs in the esp_timer task */
+static_assert(CONFIG_ESP_TIMER_TASK_AFFINITY == CONFIG_CLOCKSON_TRANSMIT_CORE,
+	"ESP_TIMER_TASK_AFFINITY must be the same as CLOCKSON_TRANSMIT_CORE");
+#endif
+
+/*
+ * The interrupt handlers read the time signal and record lateness from
+ * flash, so their interrupts must not be IRAM-safe. They are then deferred
+ * while the flash cache is disabled instead of running without it.
+ */
+#if defined(CONFIG_CLOCKSON_OUTPUT_GPTIMER) && defined(CONFIG_GPTIMER_ISR_IRAM_SAFE)
+# error "GPTIMER_ISR_IRAM_SAFE must be disabled for the gptimer output driver"
+#endif
+#if defined(CONFIG_CLOCKSON_OUTPUT_RMT) && defined(CONFIG_RMT_ISR_IRAM_SAFE)
+# error "RMT_ISR_IRAM_SAFE must be disabled for the RMT output driver"
+#endif
+
+Transmit::Transmit(Network &network, const Pins &pins, bool active_low)
+		: network_(network), active_low_(active_low),
+		next_(enabled(pins)) {
+	for (size_t i = 0; i < outputs_.size(); i++) {
+		outputs_[i].pin = pins[i];
+	}
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	gptimer_config_t gptimer_config{};
+
+	gptimer_config.clk_src = GPTIMER_CLK_SRC_XTAL;
+	gptimer_config.direction = GPTIMER_COUNT_UP;
+	gptimer_config.resolution_hz = GPTIMER_RESOLUTION_HZ;
+
+	ESP_ERROR_CHECK(gptimer_new_timer(&gptimer_config, &gptimer_));
+#else
 	esp_timer_create_args_t timer_config{};
 	timer_config.callback = event;
 	timer_config.arg = this;
@@ -47,153 +93,933 @@ Transmit::Transmit(Network &network, gpio_num_t pin, bool active_low)
 	timer_config.name = "transmit";
 
 	ESP_ERROR_CHECK(esp_timer_create(&timer_config, &timer_));
+#endif
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	rmt_copy_encoder_config_t encoder_config{};
+
+	ESP_ERROR_CHECK(rmt_new_copy_encoder(&encoder_config, &rmt_encoder_));
+
+	for (size_t i = 0; i < outputs_.size(); i++) {
+		Output &output = outputs_[i];
+
+		if (output.pin == GPIO_NUM_NC) {
+			continue;
+		}
+
+		rmt_tx_channel_config_t rmt_config{};
+
+		rmt_config.gpio_num = output.pin;
+		rmt_config.clk_src = RMT_CLK_SRC_DEFAULT;
+		rmt_config.resolution_hz = Envelope::RESOLUTION_HZ;
+		rmt_config.mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL;
+		rmt_config.trans_queue_depth = 1;
+
+		ESP_ERROR_CHECK(rmt_new_tx_channel(&rmt_config, &output.rmt_channel));
+
+		rmt_tx_event_callbacks_t callbacks{};
+
+		callbacks.on_trans_done = rmt_done;
+
+		ESP_ERROR_CHECK(rmt_tx_register_event_callbacks(output.rmt_channel,
+			&callbacks, this));
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_CARRIER
+		/*
+		 * Modulate the carrier on the active level, including while idle
+		 * because the output is parked at the active level.
+		 */
+		rmt_carrier_config_t carrier_config{};
+
+		carrier_config.frequency_hz = CARRIER_HZ[i];
+		carrier_config.duty_cycle = CARRIER_DUTY_PERCENT / 100.0f;
+		carrier_config.flags.polarity_active_low = active_low_;
+		carrier_config.flags.always_on = true;
+
+		ESP_ERROR_CHECK(rmt_apply_carrier(output.rmt_channel, &carrier_config));
+#endif
+		ESP_ERROR_CHECK(rmt_enable(output.rmt_channel));
+	}
+
+	/*
+	 * Start the transmissions on all of the channels at the same time,
+	 * instead of one after the other as rmt_transmit() is called
+	 */
+	std::array<rmt_channel_handle_t, TransmitSchedule::SIZE> channels{};
+	size_t channel_count = 0;
+
+	for (auto &output : outputs_) {
+		if (output.pin != GPIO_NUM_NC) {
+			channels[channel_count++] = output.rmt_channel;
+		}
+	}
+
+	if (channel_count > 1) {
+		rmt_sync_manager_config_t sync_config{};
+
+		sync_config.tx_channel_array = channels.data();
+		sync_config.array_size = channel_count;
+
+		ESP_ERROR_CHECK(rmt_new_sync_manager(&sync_config, &rmt_sync_));
+	}
+
+	park();
+#elif defined(CONFIG_CLOCKSON_OUTPUT_CARRIER)
+	/*
+	 * Use a separate timer for each output so that they can have different
+	 * frequencies. The carrier is turned off by setting the duty to 0 and
+	 * inverting the output if it's active low.
+	 */
+	for (size_t i = 0; i < outputs_.size(); i++) {
+		Output &output = outputs_[i];
+
+		if (output.pin == GPIO_NUM_NC) {
+			continue;
+		}
 
+		ledc_timer_bit_t resolution = static_cast<ledc_timer_bit_t>(
+			std::min<uint32_t>(LEDC_TIMER_14_BIT,
+				ledc_find_suitable_duty_resolution(LEDC_CLOCK_HZ, CARRIER_HZ[i])));
+		ledc_timer_config_t ledc_timer{};
+
+		ledc_timer.speed_mode = LEDC_LOW_SPEED_MODE;
+		ledc_timer.duty_resolution = resolution;
+		ledc_timer.timer_num = static_cast<ledc_timer_t>(LEDC_TIMER_0 + i);
+		ledc_timer.freq_hz = CARRIER_HZ[i];
+		ledc_timer.clk_cfg = LEDC_USE_APB_CLK;
+
+		ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+
+		output.ledc_channel = static_cast<ledc_channel_t>(LEDC_CHANNEL_0 + i);
+		output.duty = ((1U << resolution) * CARRIER_DUTY_PERCENT) / 100U;
+
+		ledc_channel_config_t channel_config{};
+
+		channel_config.gpio_num = output.pin;
+		channel_config.speed_mode = LEDC_LOW_SPEED_MODE;
+		channel_config.channel = output.ledc_channel;
+		channel_config.intr_type = LEDC_INTR_DISABLE;
+		channel_config.timer_sel = ledc_timer.timer_num;
+		channel_config.duty = output.duty;
+		channel_config.hpoint = 0;
+		channel_config.flags.output_invert = active_low_;
+
+		ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
+	}
+#else
 	gpio_config_t config{};
 
-	config.pin_bit_mask = 1ULL << pin,
+	config.pin_bit_mask = 0;
 	config.mode = GPIO_MODE_OUTPUT;
 	config.pull_up_en = GPIO_PULLUP_DISABLE;
 	config.pull_down_en = GPIO_PULLDOWN_DISABLE;
 	config.intr_type = GPIO_INTR_DISABLE;
 
-	ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-	ESP_ERROR_CHECK(gpio_config(&config));
+	for (auto &output : outputs_) {
+		if (output.pin != GPIO_NUM_NC) {
+			config.pin_bit_mask |= 1ULL << output.pin;
+			ESP_ERROR_CHECK(gpio_set_level(output.pin, active()));
+		}
+	}
+
+	if (config.pin_bit_mask) {
+		ESP_ERROR_CHECK(gpio_config(&config));
+	}
 
+# ifdef CONFIG_CLOCKSON_POWER_SAVE
+	/* Keep driving the output at the same level during light sleep */
+	for (auto &output : outputs_) {
+		if (output.pin != GPIO_NUM_NC) {
+			ESP_ERROR_CHECK(gpio_sleep_sel_dis(output.pin));
+		}
+	}
+# endif
+#endif
+
+	for (auto &frame : frame_buffers_) {
+		free_.push(&frame);
+	}
+
+	ESP_ERROR_CHECK(xTaskCreatePinnedToCore(frame_task, "frames", FRAME_TASK_STACK_SIZE,
+		this, FRAME_TASK_PRIORITY, &frame_task_, FRAME_TASK_CORE) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	ESP_ERROR_CHECK(xTaskCreatePinnedToCore(task, "transmit", TASK_STACK_SIZE,
+		this, TASK_PRIORITY, &task_, TASK_CORE) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+#else
 	ESP_ERROR_CHECK(esp_timer_start_once(timer_, microseconds(1s).count()));
+#endif
+}
+
+std::array<bool, TransmitSchedule::SIZE> Transmit::enabled(const Pins &pins) {
+	std::array<bool, TransmitSchedule::SIZE> enabled;
+
+	for (size_t i = 0; i < pins.size(); i++) {
+		enabled[i] = pins[i] != GPIO_NUM_NC;
+	}
+
+	return enabled;
 }
 
+void Transmit::frame_task(void *arg) {
+	reinterpret_cast<Transmit*>(arg)->frame_task();
+}
+
+/*
+ * Prepare time signals in advance so that the transmit path only needs to
+ * swap to the next one when the current one has finished. Everything that
+ * is logged to syslog happens here because only one task can do that.
+ */
+void Transmit::frame_task() {
+	while (true) {
+		if (!first_frame_reported_ && first_frame_us_) {
+			report_first_frame(first_frame_us_);
+			first_frame_reported_ = true;
+		}
+
+		if (ready_.full() && ready_late_us_) {
+			uint64_t uptime_us = esp_timer_get_time();
+
+			if (uptime_us < ready_late_us_) {
+				/* Wait for the transmit path to use the next time signal */
+				ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((ready_late_us_ - uptime_us) / 1000U) + 1);
+				continue;
+			}
+
+			/*
+			 * The transmit path has stopped. Check again in case it used the
+			 * time signal before it was marked as missed, because then it
+			 * won't clear it.
+			 */
+			missed_ = true;
+			if (!ready_.full()) {
+				missed_ = false;
+			}
+			Status::changed(Status::TRANSMIT);
+			ready_late_us_ = 0;
+		}
+
+		if (ready_.full() || (!building_ && !free_.pop(building_))) {
+			/* Wait for the transmit path to use the next time signal */
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		uint64_t wait_us;
+
+		if (prepare(*building_, wait_us)) {
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+			uint64_t first_us = building_->start_us;
+#else
+			uint64_t first_us = building_->schedule.available()
+				? building_->schedule.next().unsigned_ts() : 0;
+#endif
+			/*
+			 * It's used when the previous one has finished, and changes that
+			 * are about to happen may be skipped while the outputs are parked
+			 */
+			ready_late_us_ = first_us ? std::max({first_us, prepared_end_us_,
+				esp_timer_get_time() + PARKED_RETRY_US}) + FRAME_LATE_US : 0;
+			prepared_end_us_ = building_->end_us;
+			ready_.push(building_);
+			building_ = nullptr;
+		} else {
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_us / 1000U) + 1);
+		}
+	}
+}
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+void Transmit::task(void *arg) {
+	reinterpret_cast<Transmit*>(arg)->task();
+}
+
+/*
+ * Start each time signal and then wait for the interrupt handler to finish
+ * transmitting it. The interrupt handler only runs while an alarm is set, so
+ * the current time signal is never used by both at the same time.
+ */
+void Transmit::task() {
+	/*
+	 * The interrupt is allocated on the core that registers the callbacks,
+	 * so do that here to keep it on the same core as this task.
+	 */
+	gptimer_event_callbacks_t callbacks{};
+
+	callbacks.on_alarm = alarm;
+
+	ESP_ERROR_CHECK(gptimer_register_event_callbacks(gptimer_, &callbacks, this));
+	ESP_ERROR_CHECK(gptimer_enable(gptimer_));
+	ESP_ERROR_CHECK(gptimer_start(gptimer_));
+
+	/*
+	 * Count microseconds of uptime so that alarms can be set for the time of
+	 * each signal directly. The count will be slightly behind because it's
+	 * set after reading the time, so alarms never happen early.
+	 */
+	ESP_ERROR_CHECK(gptimer_set_raw_count(gptimer_, esp_timer_get_time()));
+
+	vTaskDelay(pdMS_TO_TICKS(1000));
+
+	while (true) {
+		uint64_t wait_us;
+
+		if (next_frame(esp_timer_get_time(), wait_us)) {
+			gptimer_alarm_config_t alarm_config{};
+
+			alarm_config.alarm_count = current_->schedule.next().unsigned_ts();
+
+			ESP_ERROR_CHECK(gptimer_set_alarm_action(gptimer_, &alarm_config));
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		} else {
+			vTaskDelay(pdMS_TO_TICKS(wait_us / 1000U) + 1);
+		}
+	}
+}
+
+bool Transmit::alarm(gptimer_handle_t timer,
+		const gptimer_alarm_event_data_t *edata, void *arg) {
+	return reinterpret_cast<Transmit*>(arg)->alarm();
+}
+
+/*
+ * Make every change that is due and then set the alarm for the next one.
+ * This runs from flash because the interrupt isn't IRAM-safe (see above).
+ */
+bool Transmit::alarm() {
+	TransmitSchedule &schedule = current_->schedule;
+
+	while (schedule.available()) {
+		auto signal = schedule.next();
+		uint64_t signal_us = signal.unsigned_ts();
+		uint64_t uptime_us = esp_timer_get_time();
+
+		if (uptime_us < signal_us) {
+			gptimer_alarm_config_t alarm_config{};
+
+			alarm_config.alarm_count = signal_us;
+			gptimer_set_alarm_action(gptimer_, &alarm_config);
+			return false;
+		}
+
+		set_carrier(outputs_[schedule.output()], signal.carrier);
+		record_lateness(signal_us, uptime_us);
+		last_us_ = uptime_us;
+		schedule.pop();
+	}
+
+	BaseType_t woken = pdFALSE;
+
+	vTaskNotifyGiveFromISR(task_, &woken);
+	return woken == pdTRUE;
+}
+#else
 void Transmit::event(void *arg) {
 	reinterpret_cast<Transmit*>(arg)->event();
 }
 
 void Transmit::event() {
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	uint64_t uptime_us = esp_timer_get_time();
+
+	if (!current_ || !current_->start_us) {
+		uint64_t wait_us;
+
+		if (!next_frame(uptime_us, wait_us)) {
+			ESP_ERROR_CHECK(esp_timer_start_once(timer_, wait_us));
+			return;
+		}
+	}
+
+	if (uptime_us < current_->start_us) {
+		ESP_ERROR_CHECK(esp_timer_start_once(timer_, current_->start_us - uptime_us));
+	} else {
+		start_rmt();
+	}
+#else
 	while (true) {
 		uint64_t uptime_us = esp_timer_get_time();
 
-		if (!current_.available()) {
+		if (!current_ || !current_->schedule.available()) {
+			uint64_t wait_us;
+
+			if (!next_frame(uptime_us, wait_us)) {
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
+				PowerSave::sleep(0);
+#endif
+				ESP_ERROR_CHECK(esp_timer_start_once(timer_, wait_us));
+				return;
+			}
+			continue;
+		}
+
+		TransmitSchedule &schedule = current_->schedule;
+		auto signal = schedule.next();
+		uint64_t signal_us = signal.unsigned_ts();
+
+		if (uptime_us < signal_us) {
+#ifdef CONFIG_CLOCKSON_POWER_SAVE
 			/*
-			 * Convert this to microseconds before applying a test offset
-			 * because the default precision of nanoseconds doesn't support
-			 * times beyond ~2554 in a uint64_t value.
+			 * Light sleep until just before the output change, then stay
+			 * awake until it happens
 			 */
-			auto now = time_point_cast<microseconds>(system_clock::now()).time_since_epoch();
-			uint64_t last_sync_us{0};
-
-			if (!Network::time_ok(&last_sync_us)) {
-				if (last_sync_us) {
-					ESP_LOGW(TAG, "Waiting for time sync (last sync %" PRIu64 "us ago)",
-						uptime_us - last_sync_us);
-				} else {
-					ESP_LOGI(TAG, "Waiting for first time sync");
-				}
-				ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-				ESP_ERROR_CHECK(esp_timer_start_once(timer_, microseconds(1s).count()));
+			uint64_t wake_us = PowerSave::wake_us(signal_us);
+
+			if (uptime_us < wake_us) {
+				PowerSave::sleep(wake_us);
+				ESP_ERROR_CHECK(esp_timer_start_once(timer_, wake_us - uptime_us));
 				return;
 			}
 
+			PowerSave::wake(uptime_us);
+#endif
+			ESP_ERROR_CHECK(esp_timer_start_once(timer_, signal_us - uptime_us));
+			return;
+		}
+
+		ESP_ERROR_CHECK(set_carrier(outputs_[schedule.output()], signal.carrier));
+		record_lateness(signal_us, uptime_us);
+		last_us_ = uptime_us;
+		schedule.pop();
+	}
+#endif
+}
+#endif
+
+/*
+ * Prepare the time signal for the minute after the last one. If there's
+ * nothing to transmit yet, the time to wait before trying again is returned
+ * in wait_us.
+ */
+bool Transmit::prepare(Frame &frame, uint64_t &wait_us) {
+	uint64_t uptime_us = esp_timer_get_time();
+	uint64_t last_sync_us{0};
+
+	if (!Network::time_ok(&last_sync_us)) {
+		if (last_sync_us) {
+			ESP_LOGW(TAG, "Waiting for time sync (last sync %" PRIu64 "us ago)",
+				uptime_us - last_sync_us);
+		} else {
+			ESP_LOGI(TAG, "Waiting for first time sync");
+		}
+		last_signal_s_ = 0;
+		wait_us = microseconds(1s).count();
+		return false;
+	}
+
+	/*
+	 * Time signals that have already been prepared can't be used after the
+	 * clock is stepped, so check for that before reading the clock.
+	 */
+	uint32_t steps = Network::time_stats().steps.load(std::memory_order_relaxed);
+
+	if (steps != last_steps_) {
+		last_signal_s_ = 0;
+		last_steps_ = steps;
+	}
+
+	if (last_signal_s_ && uptime_us < next_prepare_us_) {
+		wait_us = next_prepare_us_ - uptime_us;
+		return false;
+	}
+
+	/*
+	 * Apply the next correction to the system clock before it's used for
+	 * the next transmission. The transmissions that have already been
+	 * prepared are scheduled in uptime so they aren't affected.
+	 */
+	network_.time_slew_next();
+
+	/*
+	 * Read the system clock (in microseconds, which supports times far
+	 * beyond a test offset) between two reads of uptime so that the time
+	 * signal can be scheduled in uptime.
+	 */
+	ClockMapping clock = ClockMapping::correlate(
+		[] { return (uint64_t)esp_timer_get_time(); },
+		Network::wall_us, Network::time_rate());
+
 #ifdef CONFIG_CLOCKSON_TEST_TIME_S
 # define CLOCKSON_CONCAT_(x,y) x##y
 # define CLOCKSON_CONCAT(x,y) CLOCKSON_CONCAT_(x,y)
 # define CLOCKSON_TEST_TIME_US (uint64_t)(CLOCKSON_CONCAT(CONFIG_CLOCKSON_TEST_TIME_S, 000000ULL))
-			static auto test_offset = microseconds{CLOCKSON_TEST_TIME_US} - now;
-			now += test_offset;
+	static const int64_t test_offset_us = CLOCKSON_TEST_TIME_US - clock.wall_us();
+	clock = clock.shift(test_offset_us);
 # undef CLOCKSON_TEST_TIME_US
 # undef CLOCKSON_CONCAT
 # undef CLOCKSON_CONCAT_
 #endif
 
-			uint64_t now_us = now.count();
-			uint64_t now_s = duration_cast<seconds>(now).count();
+	uint64_t now_us = clock.wall_us();
+	uint64_t now_s = duration_cast<seconds>(microseconds{now_us}).count();
 
-			if (now_us < uptime_us) {
-				ESP_LOGE(TAG, "Invalid: now_us=%" PRIu64 " < uptime_us=%" PRIu64, now_us, uptime_us);
-				ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-				ESP_ERROR_CHECK(esp_timer_start_once(timer_, microseconds(1s).count()));
-				return;
-			}
+	if (now_us < clock.uptime_us()) {
+		ESP_LOGE(TAG, "Invalid: now_us=%" PRIu64 " < uptime_us=%" PRIu64, now_us, clock.uptime_us());
+		wait_us = microseconds(1s).count();
+		return false;
+	}
 
-			uint64_t offset_us = now_us - uptime_us;
+	/*
+	 * Start with the minute that is about to start, looking ahead 1 second
+	 * because the transmit path swaps to the next time signal up to 900ms
+	 * before the current minute finishes.
+	 */
+	now_s++;
+	now_s /= 60U;
+	now_s *= 60U;
 
-			/*
-			 * Generate time signal for the next minute (as required by the
-			 * protocol), looking ahead 1 second further because preparation for
-			 * the next transmission happens up to 900ms before the current
-			 * minute finishes.
-			 */
-			now_s++;
-			now_s /= 60U;
-			now_s++;
-			now_s *= 60U;
-
-			if (last_signal_s_ == now_s) {
-				/*
-				 * If the clock has gone backwards slightly, don't try to repeat the
-				 * same time signal twice.
-				 */
-
-				uint64_t next_minute_us = (now_us / (uint64_t)microseconds(1min).count() + 1U)
-					* (uint64_t)microseconds(1min).count()
-					- (uint64_t)microseconds(700ms).count();
-
-				if (next_minute_us < now_us) {
-					ESP_LOGE(TAG, "Invalid: next_minute_us=%" PRIu64 " < now_us=%" PRIu64, next_minute_us, now_us);
-					ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-					ESP_ERROR_CHECK(esp_timer_start_once(timer_, microseconds(1s).count()));
-					return;
-				}
-
-				uint64_t remaining_us = next_minute_us - offset_us - uptime_us;
-
-				ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-				ESP_ERROR_CHECK(esp_timer_start_once(timer_, remaining_us));
-				return;
-			}
+	report_lateness();
 
-			current_ = TimeSignal{(time_t)now_s, offset_us};
-			last_signal_s_ = now_s;
+	if (last_signal_s_ && last_signal_s_ + 60U >= now_s) {
+		next_.next_minute(clock);
+		last_signal_s_ += 60U;
+	} else {
+		/*
+		 * First transmission, the clock has been stepped or the previous
+		 * time signal has already finished
+		 */
+		next_.start((time_t)now_s, clock);
+		last_signal_s_ = now_s;
+	}
+	frames_.fetch_add(1, std::memory_order_relaxed);
 
-			std::vector<char> message(64);
+	if (next_.available()) {
+		/* The first time signal may have started before boot */
+		next_prepare_us_ = std::max<int64_t>(0, next_.next().ts
+			+ microseconds(1min).count() - (int64_t)FRAME_LEAD_US);
+	}
 
-			std::snprintf(message.data(), message.size(), "%s (offset %" PRIu64 "us)",
-				current_.time().to_string().c_str(), offset_us);
-			ESP_LOGI(TAG, "%s", message.data());
-			network_.syslog(message.data());
+	network_.syslog(ESP_LOG_INFO, TAG, FrameMessage{next_.times(), clock});
 
-			/*
-			 * Skip everything that would have happened in the past if we start
-			 * in the middle of a minute.
-			 */
-			while (current_.available() && current_.next().unsigned_ts() < uptime_us) {
-				current_.pop();
-			}
+	frame.schedule = next_;
+	frame.steps = steps;
+	frame.end_us = 0;
+	for (TransmitSchedule schedule = next_; schedule.available(); schedule.pop()) {
+		frame.end_us = schedule.next().unsigned_ts();
+	}
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	encode_rmt(frame, uptime_us);
+#endif
+	return true;
+}
 
-			/*
-			 * If the transmission times somehow overflow uint64_t, avoid going
-			 * into a fast infinite loop.
-			 */
-			if (!current_.available()) {
-				ESP_LOGW(TAG, "Nothing left to transmit");
-				ESP_ERROR_CHECK(gpio_set_level(pin_, active()));
-				ESP_ERROR_CHECK(esp_timer_start_once(timer_, microseconds(1s).count()));
-				return;
-			}
+/*
+ * Swap to the next prepared time signal after the current one has finished,
+ * discarding any that are no longer valid. If there's nothing to transmit,
+ * the output is parked and the time to wait before trying again is returned
+ * in wait_us.
+ */
+bool Transmit::next_frame(uint64_t uptime_us, uint64_t &wait_us) {
+	bool time_ok = Network::time_ok();
+	uint32_t steps = Network::time_stats().steps.load(std::memory_order_relaxed);
+	bool used = false;
+	Frame *frame;
 
-			network_.time_slew_next();
+	while (ready_.pop(frame)) {
+		used = true;
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+		/* The transmission can only be started from the beginning */
+		bool available = frame->start_us >= uptime_us;
+		uint64_t first_us = frame->first_us;
+#else
+		/*
+		 * Skip everything that would have happened in the past if we start
+		 * in the middle of a minute.
+		 */
+		TransmitSchedule &schedule = frame->schedule;
+		bool complete = true;
+
+		while (schedule.available() && schedule.next().unsigned_ts() < uptime_us) {
+			schedule.pop();
+			complete = false;
+		}
+
+		bool available = schedule.available();
+		uint64_t first_us = complete && available ? schedule.next().unsigned_ts() : 0;
+#endif
+
+		if (!time_ok || frame->steps != steps || !available) {
+			free_.push(frame);
 			continue;
 		}
 
-		auto signal = current_.next();
-		uint64_t signal_us = signal.unsigned_ts();
+		if (current_) {
+			free_.push(current_);
+		}
+		current_ = frame;
 
-		if (uptime_us < signal_us) {
-			ESP_ERROR_CHECK(esp_timer_start_once(timer_, signal_us - uptime_us));
-			return;
+		if (first_us && !first_frame_us_) {
+			first_frame_us_ = first_us;
 		}
+		break;
+	}
 
-		ESP_ERROR_CHECK(gpio_set_level(pin_, signal.carrier ? active() : inactive()));
-		last_us_ = uptime_us;
-		current_.pop();
+	if (used) {
+		/* There's space to prepare another time signal */
+		xTaskNotifyGive(frame_task_);
+
+		if (missed_.exchange(false)) {
+			Status::changed(Status::TRANSMIT);
+		}
+	}
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	if (current_ && current_->start_us) {
+#else
+	if (current_ && current_->schedule.available()) {
+#endif
+		waiting_us_ = 0;
+		set_transmitting(true);
+		return true;
+	}
+
+	if (!waiting_us_) {
+		waiting_us_ = uptime_us;
+	}
+
+	if (uptime_us - waiting_us_ < FRAME_WAIT_US) {
+		wait_us = FRAME_RETRY_US;
+	} else {
+		park();
+		wait_us = PARKED_RETRY_US;
+	}
+	return false;
+}
+
+/*
+ * Report how long it took to start transmitting a complete time signal,
+ * which is the earliest that a receiver could decode it
+ */
+void Transmit::report_first_frame(uint64_t start_us) {
+	network_.syslog(ESP_LOG_INFO, TAG,
+		FirstFrameMessage{start_us, Network::time_first_sync_us()});
+}
+
+void Transmit::report_lateness() {
+	auto summary = lateness_.reset();
+
+	if (!summary.count) {
+		return;
+	}
+
+	network_.syslog(ESP_LOG_DEBUG, TAG, LatenessMessage{summary});
+
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+	if (frames_ % BENCHMARK_FRAMES == 0) {
+		summary = benchmark_.reset();
+
+		if (summary.count) {
+			network_.syslog(ESP_LOG_INFO, TAG, BenchmarkMessage{summary});
+		}
+	}
+#endif
+}
+
+size_t Transmit::FrameMessage::format(char *text, size_t size) const {
+	size_t length = TransmitSchedule::describe(text, size, times);
+
+	if (length < size) {
+		length += std::snprintf(text + length, size - length,
+			" (offset %" PRId64 "us, rate %+.3fppm, window %" PRIu32 "us)",
+			clock.offset_us(), clock.rate_ppm(), clock.window_us());
+	}
+
+	return std::min(length, size);
+}
+
+size_t Transmit::FirstFrameMessage::format(char *text, size_t size) const {
+	int length = std::snprintf(text, size,
+		"First complete time signal %" PRIu64 "ms after boot"
+		" (%" PRIu64 "ms after time sync)", start_us / 1000U,
+		(start_us - std::min(start_us, first_sync_us)) / 1000U);
+
+	return std::min((size_t)std::max(length, 0), size);
+}
+
+size_t Transmit::LatenessMessage::format(char *text, size_t size) const {
+	int length = std::snprintf(text, size,
+		"Lateness: %" PRIu32 " changes, min %" PRIu32 "us, p50 %" PRIu32
+		"us, p99 %" PRIu32 "us, p99.9 %" PRIu32 "us, max %" PRIu32 "us",
+		summary.count, summary.min_us, summary.p50_us, summary.p99_us,
+		summary.p999_us, summary.max_us);
+
+	return std::min((size_t)std::max(length, 0), size);
+}
+
+#ifdef CONFIG_CLOCKSON_BENCHMARK
+/* Name of a core from a task affinity */
+static constexpr const char *core_name(int core) {
+	switch (core) {
+	case 0:
+		return "0";
+
+	case 1:
+		return "1";
+
+	default:
+		return "any";
+	}
+}
+
+size_t Transmit::BenchmarkMessage::format(char *text, size_t size) const {
+#ifdef CONFIG_CLOCKSON_OUTPUT_GPTIMER
+	static constexpr const char *transmit_task = "transmit task";
+	static constexpr int transmit_core = TASK_CORE;
+	static constexpr int transmit_priority = TASK_PRIORITY;
+#else
+	static constexpr const char *transmit_task = "esp_timer task";
+# ifdef CONFIG_ESP_TIMER_TASK_AFFINITY
+	static constexpr int transmit_core = CONFIG_ESP_TIMER_TASK_AFFINITY;
+# else
+	static constexpr int transmit_core = -1;
+# endif
+	static constexpr int transmit_priority = 22;
+#endif
+#ifdef CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1
+	static constexpr int wifi_core = 1;
+#else
+	static constexpr int wifi_core = 0;
+#endif
+#ifdef CONFIG_LWIP_TCPIP_TASK_AFFINITY
+	static constexpr int lwip_core = CONFIG_LWIP_TCPIP_TASK_AFFINITY;
+#else
+	static constexpr int lwip_core = -1;
+#endif
+	int length = std::snprintf(text, size,
+		"Benchmark: %s core %s priority %d, WiFi core %s, lwIP core %s, network core %s: "
+		"%" PRIu32 " changes, min %" PRIu32 "us, p50 %" PRIu32 "us, p99 %" PRIu32
+		"us, p99.9 %" PRIu32 "us, max %" PRIu32 "us",
+		transmit_task, core_name(transmit_core), transmit_priority,
+		core_name(wifi_core), core_name(lwip_core),
+		core_name(CONFIG_CLOCKSON_NETWORK_CORE),
+		summary.count, summary.min_us, summary.p50_us, summary.p99_us,
+		summary.p999_us, summary.max_us);
+
+	return std::min((size_t)std::max(length, 0), size);
+}
+#endif
+
+/* Set the outputs to the active level while there is no signal to transmit */
+void Transmit::park() {
+	set_transmitting(false);
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+	if (rmt_parked_) {
+		return;
 	}
+
+	rmt_wait();
+
+	for (auto &output : outputs_) {
+		if (output.pin == GPIO_NUM_NC) {
+			continue;
+		}
+
+		rmt_transmit_config_t config{};
+
+		config.flags.eot_level = active();
+
+		output.rmt_park = Envelope::symbol(1, active(), 1, active());
+		output.rmt_end_us = 0;
+		ESP_ERROR_CHECK(rmt_transmit(output.rmt_channel, rmt_encoder_,
+			&output.rmt_park, sizeof(output.rmt_park), &config));
+	}
+
+	rmt_parked_ = true;
+#else
+	for (auto &output : outputs_) {
+		if (output.pin != GPIO_NUM_NC) {
+			ESP_ERROR_CHECK(set_carrier(output, true));
+		}
+	}
+#endif
+}
+
+void Transmit::set_transmitting(bool transmitting) {
+	if (transmitting_.exchange(transmitting) != transmitting) {
+		Status::changed(Status::TRANSMIT);
+	}
+}
+
+/* Set the output level, or key the generated carrier on/off */
+esp_err_t Transmit::set_carrier(const Output &output, bool carrier) {
+#if defined(CONFIG_CLOCKSON_OUTPUT_CARRIER) && !defined(CONFIG_CLOCKSON_OUTPUT_RMT)
+	esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, output.ledc_channel,
+		carrier ? output.duty : 0);
+
+	if (err != ESP_OK) {
+		return err;
+	}
+
+	return ledc_update_duty(LEDC_LOW_SPEED_MODE, output.ledc_channel);
+#else
+	return gpio_set_level(output.pin, carrier ? active() : inactive());
+#endif
+}
+
+#ifdef CONFIG_CLOCKSON_OUTPUT_RMT
+/*
+ * Encode the time signal for each output in advance, so that the transmit
+ * path only has to start the transmission. It can't be started part of the
+ * way through, so skip the changes that could happen before the transmit
+ * path checks for it (at least once a second, see next_frame()).
+ */
+void Transmit::encode_rmt(Frame &frame, uint64_t uptime_us) {
+	TransmitSchedule &schedule = frame.schedule;
+	uint64_t skip_us = uptime_us + PARKED_RETRY_US + RMT_START_LEAD_US;
+	bool complete = true;
+	bool ok = true;
+
+	frame.start_us = 0;
+	frame.first_us = 0;
+
+	while (schedule.available() && schedule.next().unsigned_ts() < skip_us) {
+		schedule.pop();
+		complete = false;
+	}
+
+	if (!schedule.available()) {
+		return;
+	}
+
+	uint64_t start_us = schedule.next().unsigned_ts() - RMT_START_LEAD_US;
+
+	if (complete) {
+		frame.first_us = schedule.next().unsigned_ts();
+	}
+
+	schedule.for_each([this, &frame, start_us] (size_t output, const auto &signal) {
+		/* Start at the level before the first change */
+		frame.envelopes[output].begin(start_us,
+			signal.available() && signal.next().carrier ? inactive() : active());
+	});
+
+	while (schedule.available()) {
+		Signal signal = schedule.next();
+		Envelope &envelope = frame.envelopes[schedule.output()];
+
+		schedule.pop();
+
+		if (ok && !envelope.change(signal.unsigned_ts(),
+				signal.carrier ? active() : inactive())) {
+			ok = false;
+		}
+	}
+
+	for (auto &envelope : frame.envelopes) {
+		envelope.finish();
+	}
+
+	if (!ok) {
+		ESP_LOGE(TAG, "Unable to encode RMT symbols");
+		return;
+	}
+
+	frame.start_us = start_us;
+}
+
+/*
+ * Start transmitting the encoded envelopes. The timer is never early but it
+ * can be late, so the first duration of each envelope is shortened by that
+ * much to keep the changes at the right time. The timer is scheduled for
+ * after the last change to swap to the next minute.
+ *
+ * The RMT peripheral times every change from the start of the transmission,
+ * so the lateness of the last change is measured when it finishes (see
+ * rmt_done()).
+ */
+void Transmit::start_rmt() {
+	uint64_t start_us = current_->start_us;
+	uint64_t end_us = 0;
+
+	current_->start_us = 0;
+	rmt_wait();
+
+	/*
+	 * With more than one output, the channels all start when the last one
+	 * is started
+	 */
+	uint64_t uptime_us = esp_timer_get_time();
+
+	for (size_t i = 0; i < outputs_.size(); i++) {
+		Output &output = outputs_[i];
+
+		if (output.pin == GPIO_NUM_NC) {
+			continue;
+		}
+
+		Envelope &envelope = current_->envelopes[i];
+		rmt_transmit_config_t config{};
+
+		config.flags.eot_level = envelope.end_level();
+
+		if (envelope.size()) {
+			if (!rmt_sync_) {
+				uptime_us = esp_timer_get_time();
+			}
+
+			envelope.shift_start(uptime_us - std::min(uptime_us, start_us));
+			output.rmt_end_us = envelope.end_us();
+			ESP_ERROR_CHECK(rmt_transmit(output.rmt_channel, rmt_encoder_,
+				envelope.data(), envelope.bytes(), &config));
+			end_us = std::max(end_us, envelope.end_us());
+		} else {
+			/* Every channel has to be started when they're synchronised */
+			output.rmt_park = Envelope::symbol(1, envelope.end_level(),
+				1, envelope.end_level());
+			output.rmt_end_us = 0;
+			ESP_ERROR_CHECK(rmt_transmit(output.rmt_channel, rmt_encoder_,
+				&output.rmt_park, sizeof(output.rmt_park), &config));
+		}
+	}
+
+	rmt_parked_ = false;
+	last_us_ = end_us;
+
+	uptime_us = esp_timer_get_time();
+
+	ESP_ERROR_CHECK(esp_timer_start_once(timer_,
+		end_us > uptime_us ? end_us - uptime_us : 0));
 }
 
+/*
+ * Wait for the previous transmission to finish on every channel so that the
+ * next one can be started on all of them together
+ */
+void Transmit::rmt_wait() {
+	for (auto &output : outputs_) {
+		if (output.pin != GPIO_NUM_NC) {
+			ESP_ERROR_CHECK(rmt_tx_wait_all_done(output.rmt_channel, -1));
+		}
+	}
+
+	if (rmt_sync_) {
+		ESP_ERROR_CHECK(rmt_sync_reset(rmt_sync_));
+	}
+}
+
+bool Transmit::rmt_done(rmt_channel_handle_t channel,
+		const rmt_tx_done_event_data_t *edata, void *arg) {
+	return reinterpret_cast<Transmit*>(arg)->rmt_done(channel);
+}
+
+/*
+ * The transmission finishes with its last change (to the end of
+ * transmission level), so record the lateness of that change
+ */
+bool Transmit::rmt_done(rmt_channel_handle_t channel) {
+	uint64_t uptime_us = esp_timer_get_time();
+
+	for (auto &output : outputs_) {
+		if (output.rmt_channel == channel && output.rmt_end_us) {
+			record_lateness(output.rmt_end_us, uptime_us);
+			output.rmt_end_us = 0;
+		}
+	}
+
+	return false;
+}
+#endif
+
 } // namespace clockson
@@ -21,16 +21,13 @@
 #include <esp_timer.h>
 #include <led_strip.h>
 
-#include <chrono>
+#include <algorithm>
+#include <cstdint>
 
 #include "clockson/network.h"
+#include "clockson/status.h"
 #include "clockson/transmit.h"
 
-using std::chrono::duration_cast;
-using std::chrono::microseconds;
-using std::chrono::milliseconds;
-using namespace std::chrono_literals;
-
 namespace clockson {
 
 namespace colour = ui::colour;
@@ -48,34 +45,59 @@ UserInterface::UserInterface(Network &network, Transmit &transmit)
 	rmt_config.resolution_hz = 10 * 1000 * 1000;
 
 	ESP_ERROR_CHECK(led_strip_new_rmt_device(&led_strip_config, &rmt_config, &led_strip_));
-	set_led(colour::OFF);
+	ESP_ERROR_CHECK(led_strip_clear(led_strip_));
 }
 
+/*
+ * Update the LED when the status changes, or when the time since the last
+ * sync or the estimated error reaches one of the thresholds. Transmit raises
+ * a status change when the outputs stop or start again, so that doesn't need
+ * to be polled.
+ */
 void UserInterface::main_loop() {
 	while (true) {
 		uint64_t now_us = esp_timer_get_time();
 		uint64_t last_sync_us{0};
+		uint64_t wait_us = UINT64_MAX;
 
 		if (!network_.time_ok(&last_sync_us)) {
 			set_led(colour::ORANGE);
-		} else if (now_us - transmit_.last_us() > (uint64_t)microseconds(1s).count()) {
-			set_led(colour::RED);
-		} else if (now_us - last_sync_us > 2 * duration_cast<microseconds>(milliseconds(CONFIG_LWIP_SNTP_UPDATE_DELAY)).count()) {
-			set_led(colour::BLUE);
 		} else {
-			set_led(colour::GREEN);
+			uint64_t sync_stale_us = last_sync_us + SYNC_STALE_US;
+			/* The estimated error increases during holdover */
+			uint64_t warning_us = Network::time_error_limit_uptime_us(HOLDOVER_WARNING_US);
+
+			if (!transmit_.transmitting()) {
+				set_led(colour::RED);
+			} else if (now_us < sync_stale_us) {
+				set_led(colour::GREEN);
+			} else {
+				set_led(now_us >= warning_us ? colour::MAGENTA : colour::BLUE);
+			}
+
+			for (uint64_t threshold_us : {sync_stale_us, warning_us,
+					Network::time_valid_until_us()}) {
+				if (threshold_us > now_us) {
+					wait_us = std::min(wait_us, threshold_us - now_us);
+				}
+			}
 		}
 
-		sleep(1);
+		Status::wait(wait_us);
 	}
 }
 
 void UserInterface::set_led(RGBColour colour) {
+	if (colour == led_colour_) {
+		return;
+	}
+
 	ESP_ERROR_CHECK(led_strip_set_pixel(led_strip_, 0,
 		colour.red * LED_LEVEL / 255,
 		colour.green * LED_LEVEL / 255,
 		colour.blue * LED_LEVEL / 255));
 	ESP_ERROR_CHECK(led_strip_refresh(led_strip_));
+	led_colour_ = colour;
 }
 
 } // namespace clockson